@@ -0,0 +1,104 @@
+/*
+异步文件IO 由线程池持有（ThreadPool::io()）
+1.Linux 下使用 io_uring：提交队列/完成队列 一次系统调用批量提交
+2.io_uring 不可用时退化为几个专门的IO线程执行 pread/pwrite 不占用工作线程
+3.完成回调作为任务提交到线程池，在工作线程上执行；也可以用 future 等结果
+*/
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+#include "threadpool.h"
+#include<deque>
+#include<future>
+#include<vector>
+
+const unsigned IO_QUEUE_DEPTH = 256; // io_uring 队列深度 = 最大在途请求数
+const int IO_FALLBACK_THREADS = 4; // 退化模式下的IO线程数量
+
+class AsyncIO
+{
+public:
+    // 回调参数: 成功时为读写字节数 失败时为 -errno
+    using Callback = std::function<void(long)>;
+
+    // 一批请求 通过 submit 一次性提交
+    class Batch
+    {
+    public:
+        Batch() = default;
+        // 释放没有提交的请求
+        ~Batch();
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+        void read(int fd, void* buf, size_t len, long long offset, Callback cb);
+        void write(int fd, const void* buf, size_t len, long long offset, Callback cb);
+        size_t size() const { return reqs_.size(); }
+    private:
+        friend class AsyncIO;
+        struct Request;
+        std::vector<Request*> reqs_;
+    };
+
+    // post 把完成回调任务交给线程池 不能阻塞等待队列空位（BasicThreadPool::poster(false)）
+    AsyncIO(TaskPoster post, unsigned entries = IO_QUEUE_DEPTH);
+    // 等待所有在途请求完成 回调提交给线程池后才返回
+    ~AsyncIO();
+    AsyncIO(const AsyncIO&) = delete;
+    AsyncIO& operator=(const AsyncIO&) = delete;
+
+    // 单个请求 回调在工作线程上执行
+    void read(int fd, void* buf, size_t len, long long offset, Callback cb);
+    void write(int fd, const void* buf, size_t len, long long offset, Callback cb);
+    // 单个请求 返回 future
+    std::future<long> read(int fd, void* buf, size_t len, long long offset);
+    std::future<long> write(int fd, const void* buf, size_t len, long long offset);
+    // 批量提交 提交后 batch 为空
+    void submit(Batch& batch);
+
+    // 是否在使用 io_uring
+    bool usingIoUring() const { return ringFd_ >= 0; }
+    // 当前在途请求数量（含排队中的）
+    size_t inflight() const { return inflight_; }
+
+private:
+    using Request = Batch::Request;
+    using Completions = std::vector<std::pair<Request*, long>>;
+    void enqueue(std::vector<Request*>& reqs);
+    // 把请求结果交给线程池 队列满或提交失败就在当前线程执行回调 不等待
+    void complete(Request* req, long res);
+
+    // io_uring 后端
+    bool setupRing(unsigned entries);
+    void flushBacklog(Completions& failed); // 调用前持有 mtx_
+    void reapLoop();
+    // 退化后端
+    void offloadLoop();
+
+    TaskPoster post_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::deque<Request*> backlog_; // 等待进入提交队列 / IO线程的请求
+    std::atomic<size_t> inflight_;
+    size_t ringInflight_; // 已进入 io_uring 尚未完成的请求
+    bool isExiting_;
+    std::vector<std::thread> threads_; // reaper 线程 或 退化模式的IO线程
+
+    // io_uring 共享内存 和 内核共用的 head/tail
+    int ringFd_; // io_uring fd 小于0 表示不可用
+    unsigned sqEntries_;
+    void* sqRing_;
+    size_t sqRingSize_;
+    void* cqRing_;
+    size_t cqRingSize_;
+    void* sqes_;
+    size_t sqesSize_;
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqArray_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+    void* cqes_;
+};
+
+#endif
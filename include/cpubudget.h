@@ -0,0 +1,55 @@
+/*
+进程实际可用的 CPU（Linux 容器）
+hardware_concurrency 返回的是宿主机核数 容器里可用的 CPU 受三层限制：
+1.cgroup CPU 配额：v2 cpu.max / v1 cpu.cfs_quota_us + cpu.cfs_period_us（沿 cgroup 路径取最小值）
+2.cgroup cpuset：v2 cpuset.cpus.effective / v1 cpuset.cpus
+3.sched_getaffinity 绑核
+线程池默认线程数取三者和核数的最小值；超过配额的线程只会被 CFS 限流（throttle）
+*/
+#ifndef CPUBUDGET_H
+#define CPUBUDGET_H
+
+// 可用 CPU 预算 0 表示没有这一层限制或读不到
+struct CpuBudget
+{
+    int hardware = 0; // std::thread::hardware_concurrency
+    int affinity = 0; // sched_getaffinity 允许的 CPU 数
+    int cpuset = 0; // cgroup cpuset 中的 CPU 数
+    double quota = 0; // cgroup CPU 配额 quota / period（可以是小数 比如 1.5 个CPU）
+
+    // 线程池应该使用的线程数 至少为1 配额向上取整
+    int threads() const;
+    bool operator==(const CpuBudget& other) const
+    {
+        return hardware == other.hardware && affinity == other.affinity
+            && cpuset == other.cpuset && quota == other.quota;
+    }
+    bool operator!=(const CpuBudget& other) const { return !(*this == other); }
+
+    // 读取当前进程的 CPU 预算（每次调用都重新读 cgroup 文件）不抛异常 读不懂的文件当作没有限制
+    static CpuBudget detect();
+};
+
+// cgroup CPU 限流统计（cpu.stat）累计值 没有 cgroup 时全为0
+struct CpuThrottle
+{
+    long long periods = 0; // 经过的调度周期数
+    long long throttled = 0; // 被限流的周期数
+    long long throttledUsec = 0; // 被限流的总时间（微秒）
+
+    // 被限流的周期比例
+    double ratio() const { return periods > 0 ? (double)throttled / periods : 0; }
+    // 两次读数之差 用来看一段时间内的限流情况
+    CpuThrottle operator-(const CpuThrottle& before) const
+    {
+        CpuThrottle d;
+        d.periods = periods - before.periods;
+        d.throttled = throttled - before.throttled;
+        d.throttledUsec = throttledUsec - before.throttledUsec;
+        return d;
+    }
+
+    static CpuThrottle read();
+};
+
+#endif
@@ -0,0 +1,208 @@
+/*
+fiber 执行模式（POSIX，ucontext）
+1.线程池 setFiberMode 之后，每个任务在一个小栈的 fiber 上执行，栈用完放回工作线程的缓存
+2.任务在 fiber 里调用 Semaphore::wait / Result::get / FiberMutex / FiberConditionVariable 需要等待时，
+  只挂起 fiber，工作线程继续执行别的任务；被唤醒后 fiber 回到线程池的就绪队列，由任意工作线程继续执行
+3.少量工作线程可以同时挂着成千上万个"阻塞"中的任务
+注意：
+1.挂起前后可能换了工作线程 WorkerContext::current() 和 local() 返回的引用要重新获取
+  WorkerContext::arena() 在 fiber 里返回 fiber 自己的分配器 分配的内存可以跨越挂起点 fiber 结束时释放
+2.std::mutex / std::condition_variable / sleep 等仍然会阻塞工作线程
+3.不在 fiber 里（普通线程、非 fiber 模式的线程池）时，这些同步原语退化成普通的阻塞等待
+*/
+#ifndef FIBER_H
+#define FIBER_H
+#include<condition_variable>
+#include<cstddef>
+#include<deque>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include "workercontext.h"
+#ifndef _WIN32
+#include<ucontext.h>
+#endif
+
+const size_t FIBER_STACK_SIZE = 64 * 1024; // fiber 默认栈大小
+const size_t FIBER_STACK_CACHE = 16; // 每个工作线程缓存的空闲栈数量
+const size_t FIBER_ARENA_BLOCK = 4 * 1024; // fiber 分配器每块大小 fiber 很多 块要小
+
+class Task;
+
+class Fiber
+{
+public:
+    // 被唤醒的 fiber 交给线程池 放进就绪队列
+    using Resumer = std::function<void(Fiber*)>;
+
+    // 在当前工作线程上创建 fiber 执行 task 直到任务结束或第一次挂起
+    // 任务结束返回true 挂起返回false（之后由 resumer 重新调度）
+    static bool start(std::shared_ptr<Task> task, size_t stackSize, Resumer* resumer);
+    // 在当前工作线程上继续执行被唤醒的 fiber 返回值同 start
+    static bool resume(Fiber* fiber);
+    // 当前正在执行的 fiber 不在 fiber 里返回 nullptr
+    static Fiber* current();
+    // 挂起当前 fiber 调用方持有 lock
+    // 切回工作线程之后才释放 lock，唤醒方拿到锁时 fiber 一定已经切出；返回时重新持有 lock
+    static void suspend(std::unique_lock<std::mutex>& lock);
+    // 唤醒挂起的 fiber
+    static void wake(Fiber* fiber);
+    // 一个 fiber 栈预留的内存（栈 + 保护页）
+    static size_t reservedStackSize(size_t stackSize);
+    // 当前 fiber 的分配器 第一次调用时创建 fiber 结束时释放；不在 fiber 里返回 nullptr
+    static Arena* currentArena();
+
+    Fiber(const Fiber&) = delete;
+    Fiber& operator=(const Fiber&) = delete;
+private:
+    Fiber() = default;
+    ~Fiber() = default;
+    static void entry();
+    static bool switchTo(Fiber* fiber);
+
+    std::shared_ptr<Task> task_;
+    Resumer* resumer_ = nullptr;
+    void* stack_ = nullptr; // mmap 的起始地址 最低一页是保护页
+    size_t stackBytes_ = 0;
+    bool done_ = false;
+    std::unique_ptr<Arena> arena_; // 跟着 fiber 换线程 不会被别的任务重置
+#ifndef _WIN32
+    ucontext_t ctx_;
+#endif
+};
+
+// 挂起的 fiber 排队 由持有对应锁的唤醒方取出
+class FiberWaitQueue
+{
+public:
+    // 当前 fiber 排队并挂起 调用方持有 lock
+    void wait(std::unique_lock<std::mutex>& lock)
+    {
+        waiters_.push_back(Fiber::current());
+        Fiber::suspend(lock);
+    }
+    // 取出最早排队的 fiber 没有返回 nullptr
+    Fiber* pop()
+    {
+        if(waiters_.empty())
+            return nullptr;
+        Fiber* fiber = waiters_.front();
+        waiters_.pop_front();
+        return fiber;
+    }
+    std::deque<Fiber*> popAll()
+    {
+        std::deque<Fiber*> all;
+        all.swap(waiters_);
+        return all;
+    }
+private:
+    std::deque<Fiber*> waiters_;
+};
+
+// 互斥锁 fiber 里抢不到锁时挂起 fiber；普通线程阻塞等待
+class FiberMutex
+{
+public:
+    FiberMutex():locked_(false){}
+    FiberMutex(const FiberMutex&) = delete;
+    FiberMutex& operator=(const FiberMutex&) = delete;
+
+    void lock()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while(locked_)
+        {
+            if(Fiber::current() != nullptr)
+                fibers_.wait(lock);
+            else
+                cv_.wait(lock);
+        }
+        locked_ = true;
+    }
+    bool try_lock()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(locked_)
+            return false;
+        locked_ = true;
+        return true;
+    }
+    // 每次解锁唤醒一个等待者 优先唤醒 fiber
+    void unlock()
+    {
+        Fiber* fiber;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            locked_ = false;
+            fiber = fibers_.pop();
+            if(fiber == nullptr)
+                cv_.notify_one();
+        }
+        if(fiber != nullptr)
+            Fiber::wake(fiber);
+    }
+private:
+    std::mutex mtx_; // 保护 locked_ 和等待队列
+    bool locked_;
+    FiberWaitQueue fibers_; // 等锁的 fiber
+    std::condition_variable cv_; // 等锁的普通线程
+};
+
+// 条件变量 配合任意 BasicLockable（FiberMutex / std::mutex）使用
+class FiberConditionVariable
+{
+public:
+    FiberConditionVariable() = default;
+    FiberConditionVariable(const FiberConditionVariable&) = delete;
+    FiberConditionVariable& operator=(const FiberConditionVariable&) = delete;
+
+    template<typename Lock>
+    void wait(Lock& userLock)
+    {
+        // 先拿内部锁再放用户锁 通知方改完条件后需要内部锁才能唤醒 不会丢失唤醒
+        std::unique_lock<std::mutex> lock(mtx_);
+        userLock.unlock();
+        if(Fiber::current() != nullptr)
+            fibers_.wait(lock);
+        else
+            cv_.wait(lock);
+        lock.unlock();
+        userLock.lock();
+    }
+    template<typename Lock, typename Pred>
+    void wait(Lock& userLock, Pred pred)
+    {
+        while(!pred())
+            wait(userLock);
+    }
+    void notify_one()
+    {
+        Fiber* fiber;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            fiber = fibers_.pop();
+            if(fiber == nullptr)
+                cv_.notify_one();
+        }
+        if(fiber != nullptr)
+            Fiber::wake(fiber);
+    }
+    void notify_all()
+    {
+        std::deque<Fiber*> fibers;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            fibers = fibers_.popAll();
+            cv_.notify_all();
+        }
+        for(Fiber* fiber : fibers)
+            Fiber::wake(fiber);
+    }
+private:
+    std::mutex mtx_;
+    FiberWaitQueue fibers_;
+    std::condition_variable cv_;
+};
+
+#endif
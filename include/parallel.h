@@ -0,0 +1,356 @@
+/*
+并行算法 基于ThreadPool
+1.reduce / transform_reduce / inclusive_scan / exclusive_scan / sort / for_each
+2.只支持连续内存区间（指针、vector、array 的迭代器）
+3.自动确定粒度：按 cache block 大小切块，每个线程分 CHUNKS_PER_THREAD 块
+4.算术类型 + plus/multiplies 的归约走多路累加器 kernel，便于编译器向量化
+注意：调用线程会执行第0块并阻塞等待其余块，不要在线程池任务内部调用
+*/
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include "threadpool.h"
+#include<algorithm>
+#include<functional>
+#include<iterator>
+#include<memory>
+#include<optional>
+#include<type_traits>
+#include<vector>
+
+namespace parallel_detail
+{
+const size_t CACHE_BLOCK_BYTES = 32 * 1024; // 一个块的大小 约等于 L1d
+const size_t CHUNKS_PER_THREAD = 4; // 每个线程平均分到的块数 用来平衡负载
+const size_t SIMD_LANES = 8; // 独立累加器个数 打断加法依赖链
+
+// 包装一个块的计算 提交给线程池
+class ChunkTask : public Task
+{
+public:
+    ChunkTask(std::function<void()> func):func_(std::move(func)){}
+    Any run()
+    {
+        func_();
+        return Any();
+    }
+private:
+    std::function<void()> func_;
+};
+
+// 计算每块元素个数 保证是 cache block 的整数倍
+// 返回 n 表示数据量太小 直接串行
+template<typename T>
+size_t grainSize(size_t n, int threads)
+{
+    size_t block = std::max<size_t>(1, CACHE_BLOCK_BYTES / sizeof(T));
+    if(threads <= 1 || n <= block)
+        return n;
+    size_t chunks = (size_t)threads * CHUNKS_PER_THREAD;
+    size_t grain = (n + chunks - 1) / chunks;
+    grain = (grain + block - 1) / block * block;
+    return std::min(grain, n);
+}
+
+// 把 nChunks 个块分发到线程池 调用线程执行第0块 然后等待全部完成
+// 提交超时（任务队列满）或线程池没启动的块 由调用线程自己执行
+template<typename Pool, typename Func>
+void runChunks(Pool& pool, size_t nChunks, Func&& func)
+{
+    if(nChunks == 0)
+        return;
+    if(nChunks == 1 || !pool.checkPoolRunning())
+    {
+        for(size_t i = 0; i < nChunks; i++)
+            func(i);
+        return;
+    }
+    // Result 不可移动 用 unique_ptr 保存 保证任务执行完之前 Result 一直有效
+    std::vector<std::unique_ptr<Result>> results;
+    std::vector<size_t> rejected;
+    results.reserve(nChunks - 1);
+    for(size_t i = 1; i < nChunks; i++)
+    {
+        results.emplace_back(new Result(pool.submit(
+            std::make_shared<ChunkTask>([&func, i]() { func(i); }))));
+        if(!results.back()->isValid())
+            rejected.push_back(i);
+    }
+    func(0);
+    for(size_t i : rejected)
+        func(i);
+    for(auto& rs : results)
+        rs->get();
+}
+
+// 判断 Op 是否是可以多路累加的归约运算 返回对应的单位元
+template<typename T, typename Op>
+struct SimdReduce
+{
+    static constexpr bool value = false;
+};
+template<typename T>
+struct SimdReduce<T, std::plus<T>>
+{
+    static constexpr bool value = std::is_arithmetic_v<T>;
+    static constexpr T identity() { return T(0); }
+};
+template<typename T>
+struct SimdReduce<T, std::plus<>>
+{
+    static constexpr bool value = std::is_arithmetic_v<T>;
+    static constexpr T identity() { return T(0); }
+};
+template<typename T>
+struct SimdReduce<T, std::multiplies<T>>
+{
+    static constexpr bool value = std::is_arithmetic_v<T>;
+    static constexpr T identity() { return T(1); }
+};
+template<typename T>
+struct SimdReduce<T, std::multiplies<>>
+{
+    static constexpr bool value = std::is_arithmetic_v<T>;
+    static constexpr T identity() { return T(1); }
+};
+
+// 单块归约 kernel: init op trans(p[0]) op ... op trans(p[n-1])
+// 算术类型走 SIMD_LANES 路独立累加器 内层循环没有跨迭代依赖 可以映射到向量寄存器
+template<typename T, typename U, typename ReduceOp, typename TransOp>
+T reduceKernel(const U* p, size_t n, T init, ReduceOp reduce, TransOp trans)
+{
+    if constexpr (SimdReduce<T, ReduceOp>::value)
+    {
+        T acc[SIMD_LANES];
+        for(size_t j = 0; j < SIMD_LANES; j++)
+            acc[j] = SimdReduce<T, ReduceOp>::identity();
+        size_t i = 0;
+        for(; i + SIMD_LANES <= n; i += SIMD_LANES)
+        {
+            for(size_t j = 0; j < SIMD_LANES; j++)
+                acc[j] = reduce(acc[j], static_cast<T>(trans(p[i + j])));
+        }
+        for(; i < n; i++)
+            acc[0] = reduce(acc[0], static_cast<T>(trans(p[i])));
+        // 两两合并累加器
+        for(size_t width = SIMD_LANES / 2; width > 0; width /= 2)
+        {
+            for(size_t j = 0; j < width; j++)
+                acc[j] = reduce(acc[j], acc[j + width]);
+        }
+        return reduce(init, acc[0]);
+    }
+    else
+    {
+        for(size_t i = 0; i < n; i++)
+            init = reduce(std::move(init), trans(p[i]));
+        return init;
+    }
+}
+
+struct Identity
+{
+    template<typename U>
+    const U& operator()(const U& u) const { return u; }
+};
+
+// 连续区间的首元素地址
+template<typename It>
+auto dataOf(It it) -> decltype(std::addressof(*it))
+{
+    return std::addressof(*it);
+}
+} // namespace parallel_detail
+
+// 并行 transform + reduce
+template<typename Pool, typename It, typename T, typename ReduceOp, typename TransOp>
+T parallelTransformReduce(Pool& pool, It first, It last, T init, ReduceOp reduce, TransOp trans)
+{
+    using namespace parallel_detail;
+    using U = typename std::iterator_traits<It>::value_type;
+    size_t n = std::distance(first, last);
+    if(n == 0)
+        return init;
+    const U* p = dataOf(first);
+    size_t grain = grainSize<U>(n, pool.getCurThreadSize());
+    size_t nChunks = (n + grain - 1) / grain;
+    if(nChunks == 1)
+        return reduceKernel(p, n, std::move(init), reduce, trans);
+
+    // 每块先各自归约 最后串行合并 块的首元素作为初值 不需要单位元
+    std::vector<std::optional<T>> partials(nChunks);
+    runChunks(pool, nChunks, [&](size_t c) {
+        size_t b = c * grain;
+        size_t e = std::min(n, b + grain);
+        T seed = static_cast<T>(trans(p[b]));
+        partials[c] = reduceKernel(p + b + 1, e - b - 1, std::move(seed), reduce, trans);
+    });
+    for(auto& part : partials)
+        init = reduce(std::move(init), std::move(*part));
+    return init;
+}
+
+// 并行 reduce 要求 op 满足结合律和交换律（同 std::reduce）
+template<typename Pool, typename It, typename T, typename ReduceOp>
+T parallelReduce(Pool& pool, It first, It last, T init, ReduceOp reduce)
+{
+    return parallelTransformReduce(pool, first, last, std::move(init), reduce, parallel_detail::Identity());
+}
+
+template<typename Pool, typename It, typename T>
+T parallelReduce(Pool& pool, It first, It last, T init)
+{
+    return parallelReduce(pool, first, last, std::move(init), std::plus<>());
+}
+
+// 并行 for_each
+template<typename Pool, typename It, typename Func>
+void parallelForEach(Pool& pool, It first, It last, Func func)
+{
+    using namespace parallel_detail;
+    using U = typename std::iterator_traits<It>::value_type;
+    size_t n = std::distance(first, last);
+    if(n == 0)
+        return;
+    size_t grain = grainSize<U>(n, pool.getCurThreadSize());
+    size_t nChunks = (n + grain - 1) / grain;
+    runChunks(pool, nChunks, [&](size_t c) {
+        It b = first + c * grain;
+        It e = first + std::min(n, (c + 1) * grain);
+        std::for_each(b, e, func);
+    });
+}
+
+namespace parallel_detail
+{
+// 两遍扫描：1.每块并行求和 2.串行求块前缀 3.每块带偏移量并行扫描
+// exclusive 为 true 时 out[i] 不包含 in[i]，此时 init 必须有值
+template<typename Pool, typename It, typename OutIt, typename T, typename Op>
+OutIt scanImpl(Pool& pool, It first, It last, OutIt dFirst, Op op, std::optional<T> init, bool exclusive)
+{
+    using U = typename std::iterator_traits<It>::value_type;
+    size_t n = std::distance(first, last);
+    if(n == 0)
+        return dFirst;
+    const U* in = dataOf(first);
+    auto out = dataOf(dFirst);
+    size_t grain = grainSize<U>(n, pool.getCurThreadSize());
+    size_t nChunks = (n + grain - 1) / grain;
+
+    // 第 c 块的扫描 acc 为之前所有块的前缀
+    auto scanChunk = [&](size_t b, size_t e, std::optional<T> acc) {
+        for(size_t i = b; i < e; i++)
+        {
+            T v = static_cast<T>(in[i]); // 先读出来 支持原地扫描
+            if(exclusive)
+            {
+                out[i] = *acc;
+                acc = op(std::move(*acc), std::move(v));
+            }
+            else
+            {
+                acc = acc ? op(std::move(*acc), std::move(v)) : std::move(v);
+                out[i] = *acc;
+            }
+        }
+    };
+    if(nChunks == 1)
+    {
+        scanChunk(0, n, std::move(init));
+        return dFirst + n;
+    }
+
+    std::vector<std::optional<T>> sums(nChunks);
+    runChunks(pool, nChunks, [&](size_t c) {
+        size_t b = c * grain;
+        size_t e = std::min(n, b + grain);
+        sums[c] = reduceKernel(in + b + 1, e - b - 1, static_cast<T>(in[b]), op, Identity());
+    });
+    std::vector<std::optional<T>> offsets(nChunks);
+    offsets[0] = std::move(init);
+    for(size_t c = 1; c < nChunks; c++)
+    {
+        offsets[c] = offsets[c - 1] ? op(*offsets[c - 1], *sums[c - 1]) : *sums[c - 1];
+    }
+    runChunks(pool, nChunks, [&](size_t c) {
+        size_t b = c * grain;
+        scanChunk(b, std::min(n, b + grain), offsets[c]);
+    });
+    return dFirst + n;
+}
+} // namespace parallel_detail
+
+// 并行 inclusive_scan
+template<typename Pool, typename It, typename OutIt, typename Op, typename T>
+OutIt parallelInclusiveScan(Pool& pool, It first, It last, OutIt dFirst, Op op, T init)
+{
+    return parallel_detail::scanImpl<Pool, It, OutIt, T>(pool, first, last, dFirst, op, std::move(init), false);
+}
+
+template<typename Pool, typename It, typename OutIt, typename Op>
+OutIt parallelInclusiveScan(Pool& pool, It first, It last, OutIt dFirst, Op op)
+{
+    using T = typename std::iterator_traits<It>::value_type;
+    return parallel_detail::scanImpl<Pool, It, OutIt, T>(pool, first, last, dFirst, op, std::nullopt, false);
+}
+
+template<typename Pool, typename It, typename OutIt>
+OutIt parallelInclusiveScan(Pool& pool, It first, It last, OutIt dFirst)
+{
+    return parallelInclusiveScan(pool, first, last, dFirst, std::plus<>());
+}
+
+// 并行 exclusive_scan
+template<typename Pool, typename It, typename OutIt, typename T, typename Op>
+OutIt parallelExclusiveScan(Pool& pool, It first, It last, OutIt dFirst, T init, Op op)
+{
+    return parallel_detail::scanImpl<Pool, It, OutIt, T>(pool, first, last, dFirst, op, std::move(init), true);
+}
+
+template<typename Pool, typename It, typename OutIt, typename T>
+OutIt parallelExclusiveScan(Pool& pool, It first, It last, OutIt dFirst, T init)
+{
+    return parallelExclusiveScan(pool, first, last, dFirst, std::move(init), std::plus<>());
+}
+
+// 并行排序：每块并行 std::sort 然后逐轮两两 inplace_merge
+template<typename Pool, typename It, typename Comp>
+void parallelSort(Pool& pool, It first, It last, Comp comp)
+{
+    using namespace parallel_detail;
+    using U = typename std::iterator_traits<It>::value_type;
+    size_t n = std::distance(first, last);
+    if(n < 2)
+        return;
+    size_t grain = grainSize<U>(n, pool.getCurThreadSize());
+    size_t nChunks = (n + grain - 1) / grain;
+    // bounds[i] ~ bounds[i+1] 是一段已排序区间
+    std::vector<size_t> bounds;
+    for(size_t c = 0; c < nChunks; c++)
+        bounds.push_back(c * grain);
+    bounds.push_back(n);
+    runChunks(pool, nChunks, [&](size_t c) {
+        std::sort(first + bounds[c], first + bounds[c + 1], comp);
+    });
+    while(bounds.size() > 2)
+    {
+        size_t runs = bounds.size() - 1;
+        runChunks(pool, runs / 2, [&](size_t k) {
+            std::inplace_merge(first + bounds[2 * k], first + bounds[2 * k + 1],
+                first + bounds[2 * k + 2], comp);
+        });
+        std::vector<size_t> next;
+        for(size_t i = 0; i < bounds.size(); i += 2)
+            next.push_back(bounds[i]);
+        if(next.back() != n)
+            next.push_back(n);
+        bounds.swap(next);
+    }
+}
+
+template<typename Pool, typename It>
+void parallelSort(Pool& pool, It first, It last)
+{
+    parallelSort(pool, first, last, std::less<>());
+}
+
+#endif
@@ -0,0 +1,344 @@
+/*
+流水线 基于ThreadPool
+1.阶段之间用有界无锁队列（Channel）连接，数据按批流动，不需要每个数据提交一次任务
+2.每个阶段可以设置并行度，每个副本是一个长期运行在工作线程上的任务
+3.下游处理不过来时 Channel 满，上游 push 阻塞 = 背压逐级向上传递
+4.上游全部结束后 Channel 关闭，下游取完剩余数据后退出
+注意：线程池的线程数量 >= 所有阶段并行度之和，否则会有阶段得不到线程
+*/
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include "threadpool.h"
+#include<atomic>
+#include<chrono>
+#include<functional>
+#include<iostream>
+#include<memory>
+#include<thread>
+#include<vector>
+
+const size_t PIPE_CHANNEL_SIZE = 64; // Channel 默认容量（批数）
+const size_t PIPE_BATCH_SIZE = 256; // 每批数据个数
+
+// 有界无锁环形队列 每个槽位带序号（Vyukov MPMC）
+// 单生产者/单消费者时不需要 CAS，setSingleProducer/setSingleConsumer 打开
+template<typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t capacity)
+    {
+        size_t size = 2;
+        while(size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        slots_ = std::make_unique<Slot[]>(size);
+        for(size_t i = 0; i < size; i++)
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    void setSingleProducer(bool single) { singleProducer_ = single; }
+    void setSingleConsumer(bool single) { singleConsumer_ = single; }
+
+    // 满了返回false
+    bool tryPush(T& item)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for(;;)
+        {
+            slot = &slots_[pos & mask_];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if(dif == 0)
+            {
+                if(singleProducer_)
+                {
+                    tail_.store(pos + 1, std::memory_order_relaxed);
+                    break;
+                }
+                if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0)
+                return false;
+            else
+                pos = tail_.load(std::memory_order_relaxed);
+        }
+        slot->data = std::move(item);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    // 空了返回false
+    bool tryPop(T& item)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for(;;)
+        {
+            slot = &slots_[pos & mask_];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(dif == 0)
+            {
+                if(singleConsumer_)
+                {
+                    head_.store(pos + 1, std::memory_order_relaxed);
+                    break;
+                }
+                if(head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0)
+                return false;
+            else
+                pos = head_.load(std::memory_order_relaxed);
+        }
+        item = std::move(slot->data);
+        slot->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+private:
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+    bool singleProducer_ = false;
+    bool singleConsumer_ = false;
+    alignas(64) std::atomic<size_t> head_; // 消费位置 单独一个cache line 避免伪共享
+    alignas(64) std::atomic<size_t> tail_; // 生产位置
+};
+
+// 连接两个阶段的通道 元素是一批数据
+template<typename T>
+class Channel
+{
+public:
+    using Batch = std::vector<T>;
+    explicit Channel(size_t capacity = PIPE_CHANNEL_SIZE)
+    :ring_(capacity)
+    ,producers_(0)
+    ,consumers_(0)
+    ,isClosed_(false)
+    {}
+
+    // 阻塞写入一批 满了就退避等待（背压）
+    void push(Batch&& batch)
+    {
+        for(int spins = 0; !ring_.tryPush(batch); spins++)
+            backoff(spins);
+    }
+    // 阻塞取出一批 通道关闭且取空后返回false
+    bool pop(Batch& batch)
+    {
+        for(int spins = 0; ; spins++)
+        {
+            if(ring_.tryPop(batch))
+                return true;
+            // 关闭发生在最后一次 push 之后 再取一次保证不漏数据
+            if(isClosed_.load(std::memory_order_acquire))
+                return ring_.tryPop(batch);
+            backoff(spins);
+        }
+    }
+    // Pipeline 连线时登记生产者 / 消费者数量
+    void addProducers(int n) { producers_ += n; }
+    void addConsumers(int n) { consumers_ += n; }
+    // 生产者结束 最后一个结束时关闭通道
+    void producerDone()
+    {
+        if(--producers_ == 0)
+            isClosed_.store(true, std::memory_order_release);
+    }
+    // 根据连线情况选择 SPSC / MPMC
+    void prepare()
+    {
+        ring_.setSingleProducer(producers_ == 1);
+        ring_.setSingleConsumer(consumers_ == 1);
+    }
+private:
+    // 先自旋 再让出CPU 最后短暂睡眠
+    static void backoff(int spins)
+    {
+        if(spins < 64)
+            return;
+        if(spins < 256)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    RingBuffer<Batch> ring_;
+    std::atomic_int producers_;
+    int consumers_;
+    std::atomic_bool isClosed_;
+};
+
+namespace pipeline_detail
+{
+// 数据源 gen(Out&) 返回false表示结束
+template<typename Out, typename Gen>
+class SourceTask : public Task
+{
+public:
+    SourceTask(Channel<Out>& out, Gen gen, size_t batchSize)
+    :out_(out),gen_(std::move(gen)),batchSize_(batchSize){}
+    Any run()
+    {
+        std::vector<Out> batch;
+        batch.reserve(batchSize_);
+        Out item;
+        while(gen_(item))
+        {
+            batch.push_back(std::move(item));
+            if(batch.size() == batchSize_)
+            {
+                out_.push(std::move(batch));
+                batch = std::vector<Out>();
+                batch.reserve(batchSize_);
+            }
+        }
+        if(!batch.empty())
+            out_.push(std::move(batch));
+        out_.producerDone();
+        return Any();
+    }
+private:
+    Channel<Out>& out_;
+    Gen gen_;
+    size_t batchSize_;
+};
+
+// 中间阶段 一进一出 out = func(in)
+template<typename In, typename Out, typename Func>
+class StageTask : public Task
+{
+public:
+    StageTask(Channel<In>& in, Channel<Out>& out, Func func)
+    :in_(in),out_(out),func_(std::move(func)){}
+    Any run()
+    {
+        std::vector<In> batch;
+        while(in_.pop(batch))
+        {
+            std::vector<Out> result;
+            result.reserve(batch.size());
+            for(auto& item : batch)
+                result.push_back(func_(item));
+            out_.push(std::move(result));
+        }
+        out_.producerDone();
+        return Any();
+    }
+private:
+    Channel<In>& in_;
+    Channel<Out>& out_;
+    Func func_;
+};
+
+// 末端阶段 func(in)
+template<typename In, typename Func>
+class SinkTask : public Task
+{
+public:
+    SinkTask(Channel<In>& in, Func func):in_(in),func_(std::move(func)){}
+    Any run()
+    {
+        std::vector<In> batch;
+        while(in_.pop(batch))
+        {
+            for(auto& item : batch)
+                func_(item);
+        }
+        return Any();
+    }
+private:
+    Channel<In>& in_;
+    Func func_;
+};
+} // namespace pipeline_detail
+
+// Pool 可以是任意配置的 BasicThreadPool: Pipeline pipe(pool); 自动推导
+template<typename Pool>
+class Pipeline
+{
+public:
+    Pipeline(Pool& pool, size_t batchSize = PIPE_BATCH_SIZE)
+    :pool_(pool),batchSize_(batchSize){}
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // 数据源 单线程 gen(Out&) 返回false表示结束
+    template<typename Out, typename Gen>
+    void addSource(Channel<Out>& out, Gen gen)
+    {
+        out.addProducers(1);
+        tasks_.push_back(std::make_shared<pipeline_detail::SourceTask<Out, Gen>>(out, std::move(gen), batchSize_));
+        prepares_.push_back([&out]() { out.prepare(); });
+    }
+    // 中间阶段 degree 个副本 func(In&) -> Out 需要线程安全
+    template<typename In, typename Out, typename Func>
+    void addStage(Channel<In>& in, Channel<Out>& out, int degree, Func func)
+    {
+        in.addConsumers(degree);
+        out.addProducers(degree);
+        for(int i = 0; i < degree; i++)
+            tasks_.push_back(std::make_shared<pipeline_detail::StageTask<In, Out, Func>>(in, out, func));
+        prepares_.push_back([&in, &out]() { in.prepare(); out.prepare(); });
+    }
+    // 末端阶段 degree 个副本 func(In&) 需要线程安全
+    template<typename In, typename Func>
+    void addSink(Channel<In>& in, int degree, Func func)
+    {
+        in.addConsumers(degree);
+        for(int i = 0; i < degree; i++)
+            tasks_.push_back(std::make_shared<pipeline_detail::SinkTask<In, Func>>(in, func));
+        prepares_.push_back([&in]() { in.prepare(); });
+    }
+
+    // 启动所有阶段 阻塞到数据全部流完
+    // 线程数量不够时返回false
+    bool run()
+    {
+        if(!pool_.checkPoolRunning() || (size_t)pool_.getCurThreadSize() < tasks_.size())
+        {
+            std::cerr << "Pipeline needs " << tasks_.size() << " threads, pool has "
+                      << pool_.getCurThreadSize() << std::endl;
+            return false;
+        }
+        for(auto& prepare : prepares_)
+            prepare();
+        std::vector<std::unique_ptr<Result>> results;
+        for(auto& task : tasks_)
+        {
+            // 阶段任务必须全部运行 否则上下游会互相等待；提交超时就重试
+            for(;;)
+            {
+                std::unique_ptr<Result> rs(new Result(pool_.submit(task)));
+                if(rs->isValid())
+                {
+                    results.push_back(std::move(rs));
+                    break;
+                }
+            }
+        }
+        for(auto& rs : results)
+            rs->get();
+        tasks_.clear();
+        prepares_.clear();
+        return true;
+    }
+private:
+    Pool& pool_;
+    size_t batchSize_;
+    std::vector<std::shared_ptr<Task>> tasks_; // 每个阶段副本一个任务
+    std::vector<std::function<void()>> prepares_; // 启动前确定各个 Channel 的 SPSC/MPMC
+};
+
+#endif
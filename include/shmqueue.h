@@ -0,0 +1,95 @@
+/*
+跨进程提交任务（Linux）
+1.一个进程持有线程池并创建 ShmTaskServer，同一台机器上的其他进程用 ShmTaskClient 提交任务
+2.通道是一块共享内存（shm_open + mmap），里面有提交队列和完成队列两个无锁环形队列
+3.队列空时用 futex 睡眠，不经过 socket
+4.任务是可序列化的字节数据：kind 选择服务端注册的处理函数，payload 最多 SHM_PAYLOAD_SIZE 字节
+5.流控：服务端只在完成队列有空位时取请求，客户端不取结果时请求留在提交队列，不会占住工作线程
+一个通道服务一个客户端进程，多个客户端进程各自一个通道，可以共用同一个线程池
+*/
+#ifndef SHMQUEUE_H
+#define SHMQUEUE_H
+#ifdef __linux__
+#include "threadpool.h"
+#include<atomic>
+#include<cstdint>
+#include<string>
+#include<thread>
+#include<unordered_map>
+
+const size_t SHM_PAYLOAD_SIZE = 224; // 每个请求/结果的最大字节数
+const uint32_t SHM_RING_SIZE = 1024; // 环形队列槽位数 必须是2的幂
+const size_t SHM_DISPATCH_BATCH = 32; // 服务端一次打包成一个任务的请求数
+const int32_t SHM_STATUS_NO_HANDLER = -1; // 没有对应的处理函数
+const int32_t SHM_STATUS_BAD_LENGTH = -2; // 对端写入的长度超过 SHM_PAYLOAD_SIZE 没有执行
+
+// 完成的请求
+struct ShmCompletion
+{
+    uint64_t id; // submit 返回的请求id
+    int32_t status; // 处理函数返回值 或 SHM_STATUS_NO_HANDLER / SHM_STATUS_BAD_LENGTH
+    std::string data; // 处理函数输出
+};
+
+struct ShmSegment;
+
+// 服务端 持有共享内存 把请求交给线程池执行
+class ShmTaskServer
+{
+public:
+    // 处理函数 输入请求字节 输出结果字节 返回状态码
+    using Handler = std::function<int(const char* data, size_t len, std::string& out)>;
+
+    ShmTaskServer(TaskPoster post, const std::string& name);
+    template<typename Pool>
+    ShmTaskServer(Pool& pool, const std::string& name)
+    :ShmTaskServer(pool.poster(), name)
+    {}
+    // 停止分发 删除共享内存
+    ~ShmTaskServer();
+    ShmTaskServer(const ShmTaskServer&) = delete;
+    ShmTaskServer& operator=(const ShmTaskServer&) = delete;
+
+    // 注册处理函数 需要在 start 之前
+    void registerHandler(uint32_t kind, Handler handler);
+    // 创建共享内存 开始接收请求
+    bool start();
+
+    // 由分发出去的任务调用 执行处理函数并写回完成队列 len 超过 SHM_PAYLOAD_SIZE 时不执行
+    void process(uint32_t kind, uint64_t id, const char* data, size_t len);
+private:
+    void dispatchLoop();
+    size_t credits();
+
+    TaskPoster post_;
+    std::string name_;
+    std::unordered_map<uint32_t, Handler> handlers_;
+    ShmSegment* seg_;
+    std::atomic_bool isRunning_;
+    std::atomic_int pending_; // 已分发还没执行完的批次
+    std::atomic<uint64_t> outstanding_; // 已取出还没写回结果的请求 占用完成队列的信用
+    std::thread dispatcher_;
+};
+
+// 客户端 打开服务端创建的共享内存
+class ShmTaskClient
+{
+public:
+    ShmTaskClient();
+    ~ShmTaskClient();
+    ShmTaskClient(const ShmTaskClient&) = delete;
+    ShmTaskClient& operator=(const ShmTaskClient&) = delete;
+
+    // 连接服务端通道
+    bool connect(const std::string& name);
+    // 提交请求 提交队列满时等待（背压） 返回请求id 失败返回0
+    // 没有 wait 取走的请求最多约 2 * SHM_RING_SIZE 个 超过时 submit 会等到取走结果为止 需要和 wait 交替
+    uint64_t submit(uint32_t kind, const void* data, size_t len);
+    // 取一个完成的请求 timeoutMs < 0 一直等 超时返回false
+    bool wait(ShmCompletion& completion, int timeoutMs = -1);
+private:
+    ShmSegment* seg_;
+};
+
+#endif
+#endif
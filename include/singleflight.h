@@ -0,0 +1,79 @@
+/*
+按 key 合并任务（single-flight）+ 结果缓存
+1.同一个 key 的任务正在排队或执行时，再提交同 key 的任务不会重复执行，直接等同一次执行的返回值
+2.可选的结果缓存：执行完的返回值按 key 缓存 ttl 时间，缓存命中直接返回已经有值的 Result，不进任务队列
+3.每个调用方拿到返回值的一份拷贝 所以返回值类型需要可拷贝
+用法：pool.singleFlight().submit("user:42", task)
+*/
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+#include "threadpool.h"
+#include<chrono>
+#include<list>
+#include<string>
+#include<unordered_map>
+#include<vector>
+
+// 计数 看省下了多少次执行
+struct SingleFlightStats
+{
+    long long executed = 0; // 实际提交执行的次数
+    long long coalesced = 0; // 合并到正在执行的同 key 任务
+    long long hits = 0; // 缓存命中 没有进任务队列
+    long long expired = 0; // 缓存过期
+    long long evicted = 0; // 缓存满了淘汰
+    long long rejected = 0; // 线程池拒绝提交
+    size_t inflight = 0; // 正在排队/执行的 key
+    size_t cached = 0; // 缓存中的 key
+};
+
+class FlightWaiter;
+
+class SingleFlight
+{
+public:
+    explicit SingleFlight(TaskPoster post);
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    // 按 key 提交 线程池拒绝时所有等这次执行的 Result 变成无效（isValid 为false get 返回空值）
+    Result submit(const std::string& key, std::shared_ptr<Task> task);
+    // 打开结果缓存 最多 capacity 个 key（LRU 淘汰）每个缓存 ttl；capacity 为0关闭并清空
+    void setCache(size_t capacity, std::chrono::milliseconds ttl);
+    // 删除 key 的缓存（数据更新后）正在执行的同 key 任务结果照常交给等待者 但不再写入缓存
+    void forget(const std::string& key);
+    SingleFlightStats stats();
+
+    // 任务执行完 由工作线程调用
+    void complete(const std::string& key, Any value);
+private:
+    using Clock = std::chrono::steady_clock;
+    using Waiters = std::vector<std::shared_ptr<FlightWaiter>>;
+    // 正在执行的 key
+    struct Flight
+    {
+        Waiters waiters; // 等这次执行的调用方
+        bool stale = false; // 执行期间被 forget 结果可能是旧数据 不缓存
+    };
+    struct CacheEntry
+    {
+        Any value;
+        Clock::time_point expire;
+        std::list<std::string>::iterator lru;
+    };
+    class PostGuard;
+    // 线程池拒绝 所有等待者的 Result 变成无效
+    void fail(const std::string& key);
+    void evict();
+
+    TaskPoster post_;
+    std::mutex mtx_;
+    std::unordered_map<std::string, Flight> inflight_; // 正在执行的 key
+    std::unordered_map<std::string, CacheEntry> cache_;
+    std::list<std::string> lru_; // 最近使用的在前
+    size_t capacity_ = 0;
+    std::chrono::milliseconds ttl_{0};
+    SingleFlightStats stats_;
+};
+
+#endif
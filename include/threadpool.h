@@ -9,6 +9,16 @@
 #include<condition_variable>
 #include<functional>
 #include<unordered_map>
+#include<chrono>
+#include<iostream>
+#include<string>
+#include<deque>
+#include<list>
+#include<algorithm>
+#include<type_traits>
+#include "workercontext.h"
+#include "fiber.h"
+#include "cpubudget.h"
 // virtual 不能跟 template T （虚函数表要确定函数类型）
 // 实现上帝类，借助基类指针能指向派生类的特性
 // 实现接受任意类型的 Any上帝类
@@ -34,17 +44,27 @@ public:
         }
         return pd->data_;
     }
+    // 拷贝一份 同一个返回值交给多个调用方时使用（SingleFlight）
+    Any clone() const
+    {
+        Any any;
+        if(base_)
+            any.base_ = base_->clone();
+        return any;
+    }
 private:
     //基类类型
     class Base
     {
         public:
             virtual ~Base() = default;
+            virtual std::unique_ptr<Base> clone() const = 0;
     };
     template<typename T>
     class Derive : public Base{
         public:
             Derive(T data):data_(data){};
+            std::unique_ptr<Base> clone() const { return std::make_unique<Derive<T>>(data_); }
             T data_;
     };
     //派生类型 模版
@@ -52,6 +72,7 @@ private:
 };
 
 //信号量semaphore 实现 基于 互斥锁+条件变量
+// 在 fiber 里等待时只挂起 fiber 不阻塞工作线程
 class Semaphore
 {
 public:
@@ -74,9 +95,17 @@ public:
         //上锁
         std::unique_lock<std::mutex>lock(mtx_);
         //资源为0 阻塞
-        cv_.wait(lock,[&]()->bool {
-            return resLimit_>0;
-        });
+        if(Fiber::current() != nullptr)
+        {
+            while(resLimit_<=0)
+                fibers_.wait(lock);
+        }
+        else
+        {
+            cv_.wait(lock,[&]()->bool {
+                return resLimit_>0;
+            });
+        }
         //消耗资源
         resLimit_--;
     }
@@ -84,12 +113,18 @@ public:
     void post()
     {
         if(isExited_)return;
-        //上锁
-        std::unique_lock<std::mutex>lock(mtx_);
-        //生产资源
-        resLimit_++;
-        //通知消费者
-        cv_.notify_all();
+        Fiber* fiber;
+        {
+            //上锁
+            std::unique_lock<std::mutex>lock(mtx_);
+            //生产资源
+            resLimit_++;
+            //通知消费者 每次唤醒一个挂起的fiber
+            fiber = fibers_.pop();
+            cv_.notify_all();
+        }
+        if(fiber != nullptr)
+            Fiber::wake(fiber);
     }
 private:
 
@@ -97,25 +132,44 @@ private:
     std::condition_variable cv_;
     int resLimit_;
     std::mutex mtx_;
+    FiberWaitQueue fibers_; // 等待中的 fiber
 };
 
 class Task;
+class AsyncIO;
+class SingleFlight;
+// 把任务交给线程池 线程池不接收时返回false
+// AsyncIO / ShmTaskServer / SingleFlight 通过它提交 不依赖具体的线程池类型 由 BasicThreadPool::poster() 生成
+using TaskPoster = std::function<bool(std::shared_ptr<Task>)>;
 //Result类 获取线程池task返回的结果
 class Result
 {
 public:
-    Result(std::shared_ptr<Task> task, bool isValid = true);
-    ~Result() = default;
+    // liveCounter 不为空时 构造/析构时加减（线程池统计自己的Result）
+    Result(std::shared_ptr<Task> task, bool isValid = true, std::shared_ptr<std::atomic_int> liveCounter = nullptr);
+    // 已经有返回值的Result（缓存命中）get 不会阻塞
+    struct ReadyTag {};
+    Result(ReadyTag, Any value);
+    // 析构时和task解绑 不接收返回值的任务（丢弃Result）也能安全执行
+    ~Result();
     // 获取任务执行完的返回值
     Any get();
     //
     void setVal(Any any);
+    // 任务没有执行（提交被拒绝）isValid 变成false 唤醒阻塞在 get 上的调用方
+    void setInvalid();
+    // 任务是否提交成功（提交超时的Result无效，get不会阻塞）
+    bool isValid() const { return isValid_; }
+    // 进程内还没析构的Result数量（所有线程池共享）
+    static int liveCount() { return liveCount_; }
 private:
+    static std::atomic_int liveCount_;
     
     Any data_; //存储返回值
     std::shared_ptr<Task>task_; //获取任务对象，防止task完成后析构掉
     std::atomic_bool isValid_; //返回值有效flag
     Semaphore sem_; // 信号量 线程没完成task，要阻塞get
+    std::shared_ptr<std::atomic_int> liveCounter_; // 所属线程池的Result计数 线程池析构后也有效
 };
 
 
@@ -138,76 +192,877 @@ public:
     void exec();
     // 设置 rs
     void setResult(Result*rs);
+    // 任务不会执行了 绑定的 Result 变成无效
+    void reject();
+    // 任务对象占用的内存 用于线程池内存统计；任务持有大块数据（堆上的缓冲区等）时重写
+    // 线程池取它和 submit 时任务静态类型的 sizeof 中较大的一个
+    virtual size_t footprint() const { return sizeof(Task); }
 private:
+    template<typename, typename, typename, typename> friend class BasicThreadPool;
+    size_t queuedBytes_ = 0; // 入队时记下的内存占用 出队时减去同样的值
     Result *rs_;
+    std::mutex rsMtx_; // 保护rs_ 防止Result析构时task正在写返回值
 };
 
 
+// 工作线程属性 0 或空 表示使用系统默认值
+struct ThreadAttr
+{
+    size_t stackSize = 0; // 栈大小（字节）默认一般是8MB
+    size_t guardSize = 0; // 栈保护页大小（字节）
+    std::string name; // 线程名 会追加线程id Linux 下最多15个字符
+};
+
 //线程类型
 class Thread
 {
 public:
     using ThreadFunc = std::function<void(int)>;
     //构造函数
-    Thread(ThreadFunc func);
+    Thread(ThreadFunc func, const ThreadAttr& attr = ThreadAttr());
     //析构函数
     ~Thread();
     // 启动线程
     void start();
     // 获取线程id
     int getID() const;
+    // 按属性创建的线程 预留的栈内存（栈 + 保护页）
+    static size_t reservedStackSize(const ThreadAttr& attr);
 private:
     ThreadFunc func_;
-    static int generate_id;
+    ThreadAttr attr_;
+    static std::atomic_int generate_id;
     int threadId_; //线程id 用来映射 删除vector中哪个thread
 };
 
+// 线程池内存占用 memoryUsage() 返回
+struct PoolMemoryStats
+{
+    size_t threadCount = 0; // 线程数量
+    size_t stackBytes = 0; // 线程栈预留的虚拟内存
+    size_t queuedTasks = 0; // 队列中等待的任务
+    size_t queuedTaskBytes = 0; // 等待任务占用的内存（任务大小 + shared_ptr控制块）
+    size_t liveResults = 0; // 这个线程池 submit 返回的 还没析构的Result
+    size_t resultBytes = 0; // 这些 Result 占用的内存（不含返回值 Any 指向的数据）
+    size_t liveFibers = 0; // fiber 模式下 执行中和挂起的任务
+    size_t fiberStackBytes = 0; // 这些 fiber 的栈
+    size_t total() const { return stackBytes + queuedTaskBytes + resultBytes + fiberStackBytes; }
+};
+
+const int TASK_MAX = INT32_MAX;
+const int THREAD_MAX = 10;
+const int THREAD_MAX_IDLE_TIME = 10; //60s空闲 回收线程
+const int THREADS_PER_CPU = 2; // cached 模式默认线程上限 = 可用CPU * THREADS_PER_CPU
+const int CPU_BUDGET_REFRESH_MS = 1000; // 重新读取 CPU 预算的间隔
+const size_t FAIR_FLOW_STATS_MAX = 4096; // FairQueue 最多保留多少个没有 setFlow 的 flow 的计数
+
+// 线程池的功能由四个策略在编译期组合 没用到的功能不会生成代码（if constexpr）
+// QueuePolicy: 任务队列
+// 无界队列 submit 不会等待
+class UnboundedQueue
+{
+public:
+    static constexpr bool bounded = false;
+    static constexpr bool fair = false;
+    bool empty() const { return tasks_.empty(); }
+    size_t size() const { return tasks_.size(); }
+    // flow 只有 FairQueue 使用
+    void push(std::shared_ptr<Task> sp, int flow = 0) { (void)flow; tasks_.emplace(std::move(sp)); }
+    void onReject(int flow) { (void)flow; }
+    std::shared_ptr<Task> pop()
+    {
+        std::shared_ptr<Task> sp = std::move(tasks_.front());
+        tasks_.pop();
+        return sp;
+    }
+protected:
+    std::queue<std::shared_ptr<Task>> tasks_;
+};
+// 有界队列 队列满时 submit 最多等待1s
+class BoundedQueue : public UnboundedQueue
+{
+public:
+    static constexpr bool bounded = true;
+    void setMaxSize(int threshhold) { maxSize_ = threshhold; }
+    bool full(int flow = 0) const { (void)flow; return tasks_.size() >= (size_t)maxSize_; }
+private:
+    int maxSize_ = TASK_MAX;
+};
+
+// 每个 flow（租户）的计数
+struct FlowStats
+{
+    int weight = 1; // 权重
+    int maxQueued = TASK_MAX; // 队列中最多等待的任务数
+    size_t queued = 0; // 当前等待的任务数
+    long long submitted = 0; // 累计提交成功
+    long long rejected = 0; // 累计提交超时被拒绝
+    long long dequeued = 0; // 累计被工作线程取走
+};
+// 多租户公平队列：每个 flow 一个子队列，按权重做 deficit round robin 出队
+// 每个 flow 有自己的排队上限，一个 flow 塞满只会让它自己的 submit 等待
+// 没有 setFlow 的 flow（包括 submit 默认的 flow 0）使用默认权重和上限
+// 子队列空了就删除；计数单独保存 没有 setFlow 的 flow 最多保留 FAIR_FLOW_STATS_MAX 个 超过时淘汰最久没用的空闲 flow
+class FairQueue
+{
+public:
+    static constexpr bool bounded = true;
+    static constexpr bool fair = true;
+    // 所有 flow 加起来的上限
+    void setMaxSize(int threshhold) { maxSize_ = threshhold; }
+    // 设置 flow 的权重和排队上限 设置过的 flow 计数一直保留
+    void setFlow(int flow, int weight, int maxQueued)
+    {
+        Stats& st = touch(flow);
+        if(!st.configured)
+        {
+            lru_.erase(st.lru);
+            st.configured = true;
+        }
+        st.stats.weight = weight > 0 ? weight : 1;
+        st.stats.maxQueued = maxQueued;
+    }
+    // 没有 setFlow 的 flow 的权重和排队上限 maxQueued <= 0 表示总上限的一半
+    void setDefaultFlow(int weight, int maxQueued)
+    {
+        defaultWeight_ = weight > 0 ? weight : 1;
+        defaultMaxQueued_ = maxQueued;
+    }
+    FlowStats flowStats(int flow) const
+    {
+        auto it = stats_.find(flow);
+        if(it != stats_.end())
+            return it->second.stats;
+        FlowStats stats;
+        stats.weight = defaultWeight_;
+        stats.maxQueued = defaultMaxQueued();
+        return stats;
+    }
+    bool full(int flow) const
+    {
+        if(size_ >= (size_t)maxSize_)
+            return true;
+        auto it = stats_.find(flow);
+        return it != stats_.end() && it->second.stats.queued >= (size_t)it->second.stats.maxQueued;
+    }
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    void push(std::shared_ptr<Task> sp, int flow)
+    {
+        FlowStats& stats = touch(flow).stats;
+        std::queue<std::shared_ptr<Task>>& tasks = flows_[flow].tasks;
+        if(tasks.empty())
+            active_.push_back(flow);
+        tasks.push(std::move(sp));
+        stats.queued++;
+        stats.submitted++;
+        size_++;
+    }
+    void onReject(int flow) { touch(flow).stats.rejected++; }
+    // 队头的 flow 每轮获得 weight 个额度 每取一个任务用掉一个
+    // 额度用完排到队尾 队列空了额度清零（不允许攒额度）
+    std::shared_ptr<Task> pop()
+    {
+        int id = active_.front();
+        active_.pop_front();
+        auto it = flows_.find(id);
+        Flow& f = it->second;
+        FlowStats& stats = stats_.find(id)->second.stats;
+        if(f.deficit <= 0)
+            f.deficit += stats.weight;
+        std::shared_ptr<Task> sp = std::move(f.tasks.front());
+        f.tasks.pop();
+        f.deficit--;
+        stats.queued--;
+        stats.dequeued++;
+        size_--;
+        if(f.tasks.empty())
+            flows_.erase(it);
+        else if(f.deficit > 0)
+            active_.push_front(id);
+        else
+            active_.push_back(id);
+        return sp;
+    }
+private:
+    // 排队状态 只有有任务的 flow 才有
+    struct Flow
+    {
+        std::queue<std::shared_ptr<Task>> tasks;
+        int deficit = 0;
+    };
+    struct Stats
+    {
+        FlowStats stats;
+        bool configured = false; // setFlow 设置过 不会被淘汰 不在 lru_ 里
+        std::list<int>::iterator lru;
+    };
+    int defaultMaxQueued() const
+    {
+        return defaultMaxQueued_ > 0 ? defaultMaxQueued_ : std::max(maxSize_ / 2, 1);
+    }
+    // 取 flow 的计数 没有就按默认值创建 没有 setFlow 的移到 LRU 队头
+    Stats& touch(int flow)
+    {
+        auto it = stats_.find(flow);
+        if(it != stats_.end())
+        {
+            if(!it->second.configured)
+                lru_.splice(lru_.begin(), lru_, it->second.lru);
+            return it->second;
+        }
+        if(lru_.size() >= FAIR_FLOW_STATS_MAX)
+            evictIdle();
+        Stats& st = stats_[flow];
+        st.stats.weight = defaultWeight_;
+        st.stats.maxQueued = defaultMaxQueued();
+        lru_.push_front(flow);
+        st.lru = lru_.begin();
+        return st;
+    }
+    // 淘汰最久没用的 没有任务排队的 flow 的计数
+    void evictIdle()
+    {
+        for(auto rit = lru_.rbegin(); rit != lru_.rend(); ++rit)
+        {
+            auto it = stats_.find(*rit);
+            if(it->second.stats.queued == 0)
+            {
+                lru_.erase(std::next(rit).base());
+                stats_.erase(it);
+                return;
+            }
+        }
+    }
+    std::unordered_map<int, Flow> flows_;
+    std::unordered_map<int, Stats> stats_; // 每个 flow 的计数 队列空了也保留
+    std::list<int> lru_; // 没有 setFlow 的 flow 最近使用的在前
+    std::deque<int> active_; // 有任务的 flow 轮转顺序
+    size_t size_ = 0;
+    int maxSize_ = TASK_MAX;
+    int defaultWeight_ = 1;
+    int defaultMaxQueued_ = 0;
+};
+
+// WaitPolicy: 空闲线程怎么等任务
+// 提交任务 notify_all 唤醒所有空闲线程
+struct BlockingWait
+{
+    static constexpr bool notifyAll = true;
+    static constexpr int spinCount = 0;
+};
+// 提交任务只唤醒一个线程 取走任务后如果还有剩余再接力唤醒
+struct NotifyOneWait
+{
+    static constexpr bool notifyAll = false;
+    static constexpr int spinCount = 0;
+};
+// 取任务前先不加锁自旋 Spins 次 适合任务密集、很短的场景
+template<int Spins>
+struct SpinThenBlockWait
+{
+    static constexpr bool notifyAll = false;
+    static constexpr int spinCount = Spins;
+};
+
+// GrowthPolicy: 线程数量是否可以动态增长
+struct FixedGrowth
+{
+    static constexpr bool runtime = false;
+    static constexpr PoolMode mode = MODE_FIXED;
+};
+struct CachedGrowth
+{
+    static constexpr bool runtime = false;
+    static constexpr PoolMode mode = MODE_CACHED;
+};
+// 运行前通过 setMode 选择 fixed / cached
+struct RuntimeGrowth
+{
+    static constexpr bool runtime = true;
+    static constexpr PoolMode mode = MODE_FIXED; // 默认模式
+};
+
+// StatsPolicy: 统计 / 日志
+struct NoStats
+{
+    static constexpr bool trace = false;
+    void onSubmit() {}
+    void onReject() {}
+    void onComplete() {}
+};
+// 统计提交、拒绝、完成的任务数量
+struct CountingStats
+{
+    static constexpr bool trace = false;
+    void onSubmit() { submitted.fetch_add(1, std::memory_order_relaxed); }
+    void onReject() { rejected.fetch_add(1, std::memory_order_relaxed); }
+    void onComplete() { completed.fetch_add(1, std::memory_order_relaxed); }
+    std::atomic<long long> submitted{0};
+    std::atomic<long long> rejected{0};
+    std::atomic<long long> completed{0};
+};
+// 统计 + 打印线程取任务/执行任务的日志
+struct TracingStats : CountingStats
+{
+    static constexpr bool trace = true;
+};
+
 //线程池类型
-class ThreadPool
+template<typename QueuePolicy, typename WaitPolicy, typename GrowthPolicy, typename StatsPolicy>
+class BasicThreadPool
 {
 public:
     //线程池构造函数
-    ThreadPool();
+    BasicThreadPool()
+    :_initThreadSize(4)
+    ,_maxThreadSize(THREAD_MAX)
+    ,curThreadSize_(0)
+    ,idleThreadSize_(0)
+    ,_taskSize(0)
+    ,_nowMode(GrowthPolicy::mode)
+    ,isPoolRunning_(false)
+    {
+
+    }
     //线程池析构函数
-    ~ThreadPool();
+    ~BasicThreadPool()
+    {
+        // 先等待在途IO完成 完成回调还要提交到线程池执行
+        _io.reset();
+        {
+            std::unique_lock<std::mutex>lock(_taskQueMtx);
+            isPoolRunning_ = false;
+            _budgetCond.notify_all();
+        }
+        if(_budgetThread.joinable())
+            _budgetThread.join();
+        // 等待线程池中的线程 全部返回才析构
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        // 先抢锁 在notify
+        _notEmpty.notify_all();
+        _exitCond.wait(lock,[&]() -> bool {
+            return _threads.size() == 0;
+        });
+    }
     // 判断是否运行
-    bool checkPoolRunning() const;
-    // 设置模式
-    void setMode(PoolMode mode);
+    bool checkPoolRunning() const
+    {
+        return isPoolRunning_;
+    }
+    // 设置模式 只有 RuntimeGrowth 可以设置
+    void setMode(PoolMode mode)
+    {
+        if constexpr (GrowthPolicy::runtime)
+        {
+            if(checkPoolRunning())return;
+            _nowMode = mode;
+        }
+        else
+        {
+            (void)mode;
+        }
+    }
     // 开启线程池
-    void start(int initThreadSize = std::thread::hardware_concurrency());
-    // 设置taskQueue 任务上限
-    void setTaskQueMaxSize(int threshhold);
+    // initThreadSize 为0时按进程实际可用的 CPU（cgroup 配额、cpuset、绑核）决定 并跟随配额变化增减
+    void start(int initThreadSize = 0)
+    {
+        isPoolRunning_ = true;
+        _cpuBudget = CpuBudget::detect();
+        _autoSize = initThreadSize <= 0;
+        _initThreadSize = _autoSize ? _cpuBudget.threads() : initThreadSize;
+        if(!_userMaxThreadSize)
+            _maxThreadSize = std::max<int>(_cpuBudget.threads() * THREADS_PER_CPU, _initThreadSize);
+        _trackBudget = _autoSize || (isCached() && !_userMaxThreadSize);
+        curThreadSize_ = _initThreadSize;
+        // 创建线程对象
+        for(size_t i=0;i<_initThreadSize;i++)
+        {
+            // 绑定器 决定线程执行的函数
+            auto ptr = std::make_unique<Thread>(std::bind(&BasicThreadPool::threadFunc,this,std::placeholders::_1,takeWorkerIndex()),_threadAttr);
+            int tid = ptr->getID();
+            _threads.emplace(tid,std::move(ptr));
+        }
+        // 启动线程 线程id全局递增 按map遍历
+        for(auto& it : _threads)
+        {
+            // 线程执行 需要task 函数
+            it.second->start();
+            idleThreadSize_++; // 空闲数量
+        }
+        // 最后启动 之前的成员都不加锁初始化 refreshCpuBudget 会在锁内修改它们
+        if(_trackBudget)
+            _budgetThread = std::thread(&BasicThreadPool::budgetLoop, this);
+    }
+    // 设置taskQueue 任务上限 只有有界队列可以设置
+    void setTaskQueMaxSize(int threshhold)
+    {
+        if constexpr (QueuePolicy::bounded)
+        {
+            if(checkPoolRunning())return;
+            _taskQueue.setMaxSize(threshhold);
+        }
+        else
+        {
+            (void)threshhold;
+        }
+    }
     // 设置线程上限
-    void setThreadMaxSize(int threshhold);
+    void setThreadMaxSize(int threshhold)
+    {
+        if(checkPoolRunning())return;
+        if(isCached())
+        {
+            _maxThreadSize = threshhold;
+            _userMaxThreadSize = true;
+        }
+    }
+    // 设置工作线程属性（栈大小、保护页、线程名）
+    void setThreadAttr(const ThreadAttr& attr)
+    {
+        if(checkPoolRunning())return;
+        _threadAttr = attr;
+    }
+    // 开启 fiber 模式 每个任务在 stackSize 大小的 fiber 上执行（见 fiber.h）
+    void setFiberMode(size_t stackSize = FIBER_STACK_SIZE)
+    {
+        if(checkPoolRunning())return;
+        _fiberStackSize = stackSize;
+    }
+    // 获取当前线程数量
+    int getCurThreadSize() const { return curThreadSize_; }
+    // 设置 flow 的权重和排队上限 需要 FairQueue
+    void setFlow(int flow, int weight, int maxQueued = TASK_MAX)
+    {
+        static_assert(QueuePolicy::fair, "setFlow needs FairQueue");
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        _taskQueue.setFlow(flow, weight, maxQueued);
+    }
+    // 没有 setFlow 的 flow 的权重和排队上限 maxQueued <= 0 表示队列上限的一半 需要 FairQueue
+    void setDefaultFlow(int weight, int maxQueued = 0)
+    {
+        static_assert(QueuePolicy::fair, "setDefaultFlow needs FairQueue");
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        _taskQueue.setDefaultFlow(weight, maxQueued);
+    }
+    // flow 的计数 需要 FairQueue
+    FlowStats flowStats(int flow)
+    {
+        static_assert(QueuePolicy::fair, "flowStats needs FairQueue");
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        return _taskQueue.flowStats(flow);
+    }
+    // 统计线程池占用的内存
+    PoolMemoryStats memoryUsage()
+    {
+        PoolMemoryStats stats;
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        stats.threadCount = _threads.size();
+        stats.queuedTasks = _taskQueue.size();
+        stats.queuedTaskBytes = _queuedTaskBytes;
+        lock.unlock();
+        stats.stackBytes = stats.threadCount * Thread::reservedStackSize(_threadAttr);
+        stats.liveResults = *_liveResults;
+        stats.resultBytes = stats.liveResults * sizeof(Result);
+        if(_fiberStackSize > 0)
+        {
+            stats.liveFibers = _liveFibers;
+            stats.fiberStackBytes = stats.liveFibers * Fiber::reservedStackSize(_fiberStackSize);
+        }
+        return stats;
+    }
+    // 最近一次读取的 CPU 预算
+    CpuBudget cpuBudget()
+    {
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        return _cpuBudget;
+    }
+    // cgroup 限流统计 累计值 两次读数相减得到一段时间内的限流
+    CpuThrottle cpuThrottle() const { return CpuThrottle::read(); }
+    // 重新读取 CPU 预算 变化时调整线程数量
+    // 自动决定线程数的线程池 由后台线程每 CPU_BUDGET_REFRESH_MS 自动调用一次
+    void refreshCpuBudget()
+    {
+        CpuBudget budget = CpuBudget::detect(); // 读文件 不持有锁
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        if(!isPoolRunning_ || budget == _cpuBudget)
+            return;
+        _cpuBudget = budget;
+        int cpus = budget.threads();
+        if(!_userMaxThreadSize)
+            _maxThreadSize = cpus * THREADS_PER_CPU;
+        if(_autoSize)
+        {
+            // 配额变大 补足线程；变小 多出来的线程取任务前退出（threadFunc）
+            _initThreadSize = cpus;
+            while((size_t)curThreadSize_ < _initThreadSize)
+                addThread();
+        }
+        if(_maxThreadSize < (int)_initThreadSize)
+            _maxThreadSize = _initThreadSize;
+        _notEmpty.notify_all();
+    }
+    // 统计信息（StatsPolicy）
+    const StatsPolicy& stats() const { return _stats; }
+    // 线程池的异步IO 第一次调用时创建 完成回调在工作线程上执行
+    // 使用前需要 #include "asyncio.h"
+    AsyncIO& io()
+    {
+        std::call_once(_ioOnce,[this]() {
+            // 完成回调在 reaper 线程上提交 不能等队列空位
+            _io = std::make_shared<AsyncIO>(poster(false));
+        });
+        return *_io;
+    }
+    // 按 key 合并任务 + 结果缓存 第一次调用时创建
+    // 使用前需要 #include "singleflight.h"
+    SingleFlight& singleFlight()
+    {
+        std::call_once(_flightOnce,[this]() {
+            _flight = std::make_shared<SingleFlight>(poster());
+        });
+        return *_flight;
+    }
+    // 提交到这个线程池的 TaskPoster 线程池没运行或拒绝时返回false
+    // wait 为 false 时队列满不等待（调用方不能阻塞）
+    TaskPoster poster(bool wait = true)
+    {
+        return [this, wait](std::shared_ptr<Task> task) -> bool {
+            if(!checkPoolRunning())
+                return false;
+            Result rs = wait ? submit(task) : trySubmit(task);
+            return rs.isValid();
+        };
+    }
     // 提交任务
-    Result submit(std::shared_ptr<Task>sp);
-    // // 设置初始线程数
-    // void setInitThreadSize(int size);
+    // flow 标识租户 只有 FairQueue 区分
+    // 任务的静态类型用来统计任务占用的内存 传 make_shared<MyTask>(...) 的结果即可
+    template<typename T>
+    Result submit(std::shared_ptr<T> sp, int flow = 0)
+    {
+        static_assert(std::is_base_of<Task, T>::value, "submit needs a Task");
+        return submitTask(std::move(sp), flow, true, sizeof(T));
+    }
+    // 其他能转换成 shared_ptr<Task> 的（unique_ptr 等）不知道真实类型 按 footprint() 统计
+    Result submit(std::shared_ptr<Task> sp, int flow = 0)
+    {
+        return submitTask(std::move(sp), flow, true, sizeof(Task));
+    }
+    // 提交任务 队列满时不等待 直接返回无效的 Result
+    template<typename T>
+    Result trySubmit(std::shared_ptr<T> sp, int flow = 0)
+    {
+        static_assert(std::is_base_of<Task, T>::value, "trySubmit needs a Task");
+        return submitTask(std::move(sp), flow, false, sizeof(T));
+    }
+    Result trySubmit(std::shared_ptr<Task> sp, int flow = 0)
+    {
+        return submitTask(std::move(sp), flow, false, sizeof(Task));
+    }
     // 禁止拷贝构造、赋值构造
-    ThreadPool(const ThreadPool&) = delete;
-    ThreadPool& operator=(const ThreadPool&) = delete;
+    BasicThreadPool(const BasicThreadPool&) = delete;
+    BasicThreadPool& operator=(const BasicThreadPool&) = delete;
+private:
+    // wait 为 true 时队列满最多等待1s size 为任务静态类型的大小
+    Result submitTask(std::shared_ptr<Task> sp, int flow, bool wait, size_t size)
+    {
+        // 上锁
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        if constexpr (QueuePolicy::bounded)
+        {
+            // 用户提交任务 阻塞超过一秒 判断提交失败
+            // 等待任务 线程通信 cv
+            auto notFull = [&]()->bool { return !_taskQueue.full(flow); };
+            if(wait ? !_notFull.wait_for(lock,std::chrono::seconds(1),notFull) : !notFull())
+            {
+                // 超时 出错
+                if(wait)
+                    std::cerr << "Task Submit TimeOut 1s , TaskQue is Full" << std::endl;
+                _stats.onReject();
+                _taskQueue.onReject(flow);
+                return Result(sp,false,_liveResults);
+            }
+        }
+        // 有空位 提交任务
+        sp->queuedBytes_ = std::max(size, sp->footprint()) + 2 * sizeof(long); // make_shared 控制块
+        _queuedTaskBytes += sp->queuedBytes_;
+        _taskQueue.push(sp, flow);
+        _taskSize++;
+        _stats.onSubmit();
+
+        // notEmpty 通知 可以分配工作线程
+        notifyNotEmpty();
+
+        // cached 模式下，根据任务数量和空闲线程数量，判断是否要 新增线程
+        // 适合 小而快的任务
+        // 线程太多对性能有影响
+        //cached模式 + 当前线程数量小于线程数量上限 + 当前任务数量大于空闲线程数量
+        if(isCached()
+            && curThreadSize_ < _maxThreadSize
+            && _taskSize > idleThreadSize_)
+        {
+            addThread();
+        }
+        return Result(sp,true,_liveResults);
+    }
 private:
     std::unordered_map<int,std::unique_ptr<Thread>>_threads; //线程map
-    //std::vector<std::unique_ptr<Thread>> _threads; // 线程列表 智能指针管理内存
     size_t _initThreadSize; // 初始线程数量
     int _maxThreadSize; // 线程最大上限 适用于cached 模式
     std::atomic_int curThreadSize_; //当前总线程数量
     std::atomic_int idleThreadSize_; // 工作线程数量
 
-    std::queue<std::shared_ptr<Task>> _taskQueue; // 任务队列 
-    std::atomic_int _taskSize; // 队列任务数量 
-    int _maxTaskSize; // 任务最大上限
+    QueuePolicy _taskQueue; // 任务队列
+    std::atomic_int _taskSize; // 队列任务数量
     std::mutex _taskQueMtx; // 互斥访问任务队列
-    std::condition_variable _notFull; // 表示任务队列不满
+    std::condition_variable _notFull; // 表示任务队列不满 只有有界队列使用
     std::condition_variable _notEmpty; // 表示任务队列不空
     std::condition_variable _exitCond; // 等待线程资源全部回收
 
+    size_t _queuedTaskBytes = 0; // 队列中任务占用的内存 受 _taskQueMtx 保护
+    std::shared_ptr<std::atomic_int> _liveResults{std::make_shared<std::atomic_int>(0)}; // submit 返回的Result
+    ThreadAttr _threadAttr; // 工作线程属性
+    std::vector<bool> _workerIndices; // 线程编号是否被占用 受 _taskQueMtx 保护
+
     PoolMode _nowMode; // 当前线程池工作模式
     std::atomic_bool isPoolRunning_; // 线程池运行状态
-    
+    StatsPolicy _stats; // 统计信息
+
+    CpuBudget _cpuBudget; // 最近一次读取的 CPU 预算 受 _taskQueMtx 保护
+    bool _autoSize = false; // 线程数由 CPU 预算决定
+    bool _userMaxThreadSize = false; // 用户设置过线程上限 不再按 CPU 预算调整
+    bool _trackBudget = false; // 后台线程定期重新读取 CPU 预算
+    std::thread _budgetThread; // 每 CPU_BUDGET_REFRESH_MS 调用 refreshCpuBudget
+    std::condition_variable _budgetCond; // 线程池析构时叫醒 _budgetThread
+
+    std::shared_ptr<AsyncIO> _io; // 异步IO 懒创建
+    std::once_flag _ioOnce;
+    std::shared_ptr<SingleFlight> _flight; // 按 key 合并任务 懒创建
+    std::once_flag _flightOnce;
+
+    size_t _fiberStackSize = 0; // fiber 栈大小 0 表示不使用 fiber
+    std::deque<Fiber*> _fiberReady; // 被唤醒等待继续执行的 fiber 受 _taskQueMtx 保护
+    std::atomic_int _liveFibers{0}; // 执行中和挂起的 fiber
+    Fiber::Resumer _fiberResumer{[this](Fiber* fiber) { resumeFiber(fiber); }};
+
 private:
-    void threadFunc(int threadID);
+    // 非 RuntimeGrowth 时是编译期常量 相关分支直接被优化掉
+    bool isCached() const
+    {
+        if constexpr (GrowthPolicy::runtime)
+            return PoolMode::MODE_CACHED == _nowMode;
+        else
+            return PoolMode::MODE_CACHED == GrowthPolicy::mode;
+    }
+    // 新建并启动一个线程 持有 _taskQueMtx
+    void addThread()
+    {
+        auto ptr = std::make_unique<Thread>(std::bind(&BasicThreadPool::threadFunc,this,std::placeholders::_1,takeWorkerIndex()),_threadAttr);
+        int tid = ptr->getID();
+        _threads.emplace(tid,std::move(ptr));
+        _threads[tid]->start(); // 启动线程
+        curThreadSize_++;
+        idleThreadSize_++;
+        if constexpr (StatsPolicy::trace)
+            std::cout<<"Create New Thread:"<<std::endl;
+    }
+    // 最小的空闲线程编号 持有 _taskQueMtx（start 时线程还没启动）
+    int takeWorkerIndex()
+    {
+        auto it = std::find(_workerIndices.begin(), _workerIndices.end(), false);
+        if(it != _workerIndices.end())
+        {
+            *it = true;
+            return (int)(it - _workerIndices.begin());
+        }
+        _workerIndices.push_back(true);
+        return (int)_workerIndices.size() - 1;
+    }
+    // 定期重新读取 CPU 预算 读 cgroup 文件不占用提交者和工作线程
+    void budgetLoop()
+    {
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        while(isPoolRunning_)
+        {
+            _budgetCond.wait_for(lock,std::chrono::milliseconds(CPU_BUDGET_REFRESH_MS));
+            if(!isPoolRunning_)
+                break;
+            lock.unlock();
+            refreshCpuBudget();
+            lock.lock();
+        }
+    }
+    // 唤醒的 fiber 放进就绪队列 不受任务队列上限限制 线程池停止后也要接收
+    void resumeFiber(Fiber* fiber)
+    {
+        std::unique_lock<std::mutex>lock(_taskQueMtx);
+        _fiberReady.push_back(fiber);
+        notifyNotEmpty();
+    }
+    // 执行任务或继续执行 fiber 任务挂起时返回false
+    bool execute(std::shared_ptr<Task>& task, Fiber* fiber)
+    {
+        if(fiber == nullptr && _fiberStackSize == 0)
+        {
+            task->exec();
+            return true;
+        }
+        bool done;
+        if(fiber != nullptr)
+        {
+            done = Fiber::resume(fiber);
+        }
+        else
+        {
+            _liveFibers++;
+            done = Fiber::start(std::move(task), _fiberStackSize, &_fiberResumer);
+        }
+        // 最后一个 fiber 结束 线程池已经停止时 让等待退出的线程重新检查
+        if(done && --_liveFibers == 0 && !isPoolRunning_)
+        {
+            std::unique_lock<std::mutex>lock(_taskQueMtx);
+            _notEmpty.notify_all();
+        }
+        return done;
+    }
+    void notifyNotEmpty()
+    {
+        if constexpr (WaitPolicy::notifyAll)
+            _notEmpty.notify_all();
+        else
+            _notEmpty.notify_one();
+    }
+    // 线程执行任务函数 线程从任务队列消费任务
+    // 线程池里有任务，必须等到任务完成，才能析构
+    void threadFunc(int threadID, int workerIndex)
+    {
+        auto lastTime = std::chrono::high_resolution_clock().now();
+        // 工作线程上下文 任务通过 WorkerContext::current() 访问
+        WorkerContext context(threadID, workerIndex);
+        // 循环接受任务
+        for(;;)
+        {
+            std::shared_ptr<Task>task;
+            Fiber* fiber = nullptr;
+            if constexpr (WaitPolicy::spinCount > 0)
+            {
+                // 不加锁自旋 等任务来 避免线程频繁睡眠/唤醒
+                for(int i=0;i<WaitPolicy::spinCount && _taskSize==0 && isPoolRunning_;i++)
+                    std::this_thread::yield();
+            }
+            {
+                // 1.获取锁
+                std::unique_lock<std::mutex>lock(_taskQueMtx);
+
+                if constexpr (StatsPolicy::trace)
+                    std::cout<<"tid:"<<std::this_thread::get_id()<<" Try Get Task"<<std::endl;
+
+                // 区分超时返回 and 有任务待执行返回
+                for(;;)
+                {
+                    // CPU 预算变小 超出的线程退出（fixed 看核心线程数 cached 看上限）
+                    // 等待中被 refreshCpuBudget 唤醒后也要检查
+                    if(curThreadSize_ > (int)_initThreadSize && (!isCached() || curThreadSize_ > _maxThreadSize))
+                    {
+                        _threads.erase(threadID);
+                        _workerIndices[workerIndex] = false;
+                        _exitCond.notify_all();
+                        curThreadSize_--;
+                        idleThreadSize_--;
+                        if constexpr (StatsPolicy::trace)
+                            std::cout<<"ThreadID:"<<std::this_thread::get_id()<<" exit!"<<std::endl;
+                        return;
+                    }
+                    if(!_taskQueue.empty() || !_fiberReady.empty())
+                        break;
+                    // 没任务 当前如果线程池已经关闭，则回收线程（挂起的 fiber 都执行完之后）
+                    if(isPoolRunning_ == false && _liveFibers == 0)
+                    {
+                        //回收线程
+                        _threads.erase(threadID);
+                        _workerIndices[workerIndex] = false;
+                        _exitCond.notify_all();
+                        if constexpr (StatsPolicy::trace)
+                            std::cout<<"ThreadID:"<<std::this_thread::get_id()<<" exit!"<<std::endl;
+                        return;
+                    }
+                    // cached 模式 如果空闲时间达到THREAD_MAX_IDLE_TIME 回收线程
+                    if(isCached())
+                    {
+                        // 条件变量超时返回 没抢到任务
+                        if(std::cv_status::timeout ==
+                            _notEmpty.wait_for(lock,std::chrono::seconds(1)))
+                        {
+                            auto nowTime = std::chrono::high_resolution_clock().now();
+                            auto dur = std::chrono::duration_cast<std::chrono::seconds>(nowTime-lastTime);
+                            if((size_t)curThreadSize_>_initThreadSize && dur.count() >= THREAD_MAX_IDLE_TIME)
+                            {
+                                // 回收当前线程
+                                // 线程map 删除对象；线程相关变量修改
+                                _threads.erase(threadID);
+                                _workerIndices[workerIndex] = false;
+                                _exitCond.notify_all();
+                                curThreadSize_--;
+                                idleThreadSize_--;
+                                if constexpr (StatsPolicy::trace)
+                                    std::cout<<"ThreadID:"<<std::this_thread::get_id()<<" exit!"<<std::endl;
+                                return; // 结束线程
+                            }
+                        }
+                    }
+                    else // fixed 模式 一直wait
+                    {
+                        _notEmpty.wait(lock);
+                    }
+                }
+
+                if constexpr (StatsPolicy::trace)
+                    std::cout<<"tid:"<<std::this_thread::get_id()<<" Success Get Task"<<std::endl;
+                idleThreadSize_--; // 线程取任务 不空闲
+                // 2.先继续被唤醒的 fiber 再从任务队列获取新任务
+                if(!_fiberReady.empty())
+                {
+                    fiber = _fiberReady.front();
+                    _fiberReady.pop_front();
+                }
+                else
+                {
+                    task = _taskQueue.pop();
+                    _taskSize--;
+                    _queuedTaskBytes -= task->queuedBytes_;
+                    // 可以继续提交任务
+                    if constexpr (QueuePolicy::bounded)
+                        _notFull.notify_all();
+                }
+
+                // 可以继续执行任务
+                if(!_taskQueue.empty() || !_fiberReady.empty())
+                    notifyNotEmpty();
+                // 3.当前线程执行任务 释放锁
+            }
+            if(task!=nullptr || fiber!=nullptr)
+            {
+                bool done = execute(task, fiber);
+                if(done)
+                {
+                    // fiber 只是挂起时任务还没结束 不能重置
+                    context.afterTask();
+                    _stats.onComplete();
+                    // 执行完任务 通知
+                    if constexpr (StatsPolicy::trace)
+                        std::cout<<"Task Finished"<<std::endl;
+                }
+            }
+            idleThreadSize_++; // 任务完成 空闲
+            // 更新使用时间
+            lastTime = std::chrono::high_resolution_clock().now();
+        }
+    }
 };
 
-#endif
\ No newline at end of file
+// 原来的线程池: 有界队列 + notify_all + 运行时选择 fixed/cached + 统计和日志
+using ThreadPool = BasicThreadPool<BoundedQueue, BlockingWait, RuntimeGrowth, TracingStats>;
+// 多租户线程池: 按 flow 加权公平调度
+using FairThreadPool = BasicThreadPool<FairQueue, BlockingWait, RuntimeGrowth, CountingStats>;
+
+#endif
@@ -0,0 +1,122 @@
+/*
+工作线程上下文 任务在 run() 里通过 WorkerContext::current() 拿到
+1.当前工作线程在线程池内的编号（可以直接做数组下标）
+2.按类型区分的线程私有对象 第一次使用时创建 线程退出时析构（解析器、压缩上下文等）
+  工作线程是分离的 私有对象可能在线程池析构返回之后才析构 析构函数里不要再访问线程池
+3.线程私有的 bump 分配器 每个任务执行完自动重置（临时缓冲区）
+  fiber 模式下每个 fiber 用自己的分配器 挂起、换线程都不会被重置 fiber 结束时释放
+昂贵的初始化从每个任务一次变成每个线程一次
+*/
+#ifndef WORKERCONTEXT_H
+#define WORKERCONTEXT_H
+#include<atomic>
+#include<cstddef>
+#include<memory>
+#include<new>
+#include<type_traits>
+#include<utility>
+#include<vector>
+
+const size_t WORKER_ARENA_BLOCK = 64 * 1024; // 分配器每块大小
+
+// bump 分配器 只能整体释放 reset 后内存块留着复用
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = WORKER_ARENA_BLOCK);
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    // 分配 size 字节 不会返回 nullptr
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+    // 在分配器上构造对象 reset 时不会调用析构函数 所以只允许平凡析构的类型
+    template<typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena only holds trivially destructible types");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    template<typename T>
+    T* allocArray(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena only holds trivially destructible types");
+        return static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+    }
+    // 释放全部分配 保留内存块
+    void reset();
+    // 当前已分配的字节数
+    size_t used() const { return used_; }
+    // 持有的内存块总大小
+    size_t capacity() const;
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t blockSize_;
+    size_t cur_; // 当前块
+    size_t offset_; // 当前块已用
+    size_t used_;
+};
+
+class WorkerContext
+{
+public:
+    // 构造时成为当前线程的上下文 析构时撤销
+    WorkerContext(int threadId, int workerIndex);
+    ~WorkerContext();
+    WorkerContext(const WorkerContext&) = delete;
+    WorkerContext& operator=(const WorkerContext&) = delete;
+
+    // 当前线程的上下文 不是工作线程时返回 nullptr
+    static WorkerContext* current() { return current_; }
+    // 线程在所属线程池内的编号 从0开始 同一时刻不重复 退出线程的编号由新线程复用
+    // 不超过线程池的线程上限 可以用来索引按线程上限分配的数组
+    int workerIndex() const { return workerIndex_; }
+    // Thread id 进程内所有线程池共用一个递增计数 只用来区分线程
+    int threadId() const { return threadId_; }
+    // 线程私有对象 第一次调用时默认构造
+    // fiber 挂起后可能在别的线程继续 返回的引用不要跨越挂起点使用 恢复后重新调用
+    template<typename T>
+    T& local()
+    {
+        return local<T>([]() { return new T(); });
+    }
+    // 线程私有对象 第一次调用时用 create() 返回的指针
+    template<typename T, typename Create>
+    T& local(Create create)
+    {
+        size_t slot = slotOf<T>();
+        if(slot >= slots_.size())
+            slots_.resize(slot + 1);
+        if(!slots_[slot])
+            slots_[slot] = std::shared_ptr<void>(static_cast<T*>(create()));
+        return *static_cast<T*>(slots_[slot].get());
+    }
+    // 线程私有分配器 任务结束后重置；在 fiber 里返回 fiber 自己的分配器
+    Arena& arena();
+    // 线程池在每个任务执行完（不包括 fiber 挂起）后调用
+    void afterTask()
+    {
+        if(arena_.used() > 0)
+            arena_.reset();
+    }
+private:
+    // 每个类型一个槽位编号
+    template<typename T>
+    static size_t slotOf()
+    {
+        static const size_t slot = nextSlot_++;
+        return slot;
+    }
+    static std::atomic<size_t> nextSlot_;
+    static thread_local WorkerContext* current_;
+
+    int threadId_;
+    int workerIndex_;
+    std::vector<std::shared_ptr<void>> slots_; // shared_ptr<void> 记住了真实类型的析构函数
+    Arena arena_;
+};
+
+#endif
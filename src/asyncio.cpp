@@ -0,0 +1,385 @@
+#include "asyncio.h"
+#include<algorithm>
+#include<cerrno>
+#include<cstring>
+#include<iostream>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ASYNCIO_URING 1
+#include<linux/io_uring.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include<sys/uio.h>
+#endif
+#ifdef _WIN32
+#include<io.h>
+#else
+#include<unistd.h>
+#endif
+
+// 一个读写请求 提交后由 AsyncIO 负责释放
+struct AsyncIO::Batch::Request
+{
+    bool isWrite;
+    int fd;
+    void* buf;
+    size_t len;
+    long long offset;
+    Callback cb;
+#ifdef ASYNCIO_URING
+    struct iovec iov; // readv/writev 要求 iovec 在完成前一直有效
+#endif
+};
+
+// 完成回调 作为任务在工作线程上执行
+class IoCompleteTask : public Task
+{
+public:
+    IoCompleteTask(AsyncIO::Callback cb, long res):cb_(std::move(cb)),res_(res){}
+    Any run()
+    {
+        cb_(res_);
+        return Any();
+    }
+private:
+    AsyncIO::Callback cb_;
+    long res_;
+};
+
+AsyncIO::Batch::~Batch()
+{
+    for(Request* req : reqs_)
+        delete req;
+}
+
+void AsyncIO::Batch::read(int fd, void* buf, size_t len, long long offset, Callback cb)
+{
+    Request* req = new Request();
+    req->isWrite = false;
+    req->fd = fd;
+    req->buf = buf;
+    req->len = len;
+    req->offset = offset;
+    req->cb = std::move(cb);
+    reqs_.push_back(req);
+}
+
+void AsyncIO::Batch::write(int fd, const void* buf, size_t len, long long offset, Callback cb)
+{
+    read(fd, const_cast<void*>(buf), len, offset, std::move(cb));
+    reqs_.back()->isWrite = true;
+}
+
+AsyncIO::AsyncIO(TaskPoster post, unsigned entries)
+:post_(std::move(post))
+,inflight_(0)
+,ringInflight_(0)
+,isExiting_(false)
+,ringFd_(-1)
+,sqEntries_(0)
+,sqRing_(nullptr)
+,sqRingSize_(0)
+,cqRing_(nullptr)
+,cqRingSize_(0)
+,sqes_(nullptr)
+,sqesSize_(0)
+{
+    if(setupRing(entries))
+    {
+        threads_.emplace_back(&AsyncIO::reapLoop,this);
+    }
+    else
+    {
+        // io_uring 不可用 用专门的IO线程阻塞读写
+        for(int i=0;i<IO_FALLBACK_THREADS;i++)
+            threads_.emplace_back(&AsyncIO::offloadLoop,this);
+    }
+}
+
+AsyncIO::~AsyncIO()
+{
+    {
+        std::unique_lock<std::mutex>lock(mtx_);
+        isExiting_ = true;
+        cond_.notify_all();
+    }
+    for(auto& t : threads_)
+        t.join();
+#ifdef ASYNCIO_URING
+    if(ringFd_ >= 0)
+    {
+        munmap(sqes_, sqesSize_);
+        if(cqRing_ != sqRing_)
+            munmap(cqRing_, cqRingSize_);
+        munmap(sqRing_, sqRingSize_);
+        close(ringFd_);
+    }
+#endif
+}
+
+void AsyncIO::read(int fd, void* buf, size_t len, long long offset, Callback cb)
+{
+    Batch batch;
+    batch.read(fd, buf, len, offset, std::move(cb));
+    submit(batch);
+}
+
+void AsyncIO::write(int fd, const void* buf, size_t len, long long offset, Callback cb)
+{
+    Batch batch;
+    batch.write(fd, buf, len, offset, std::move(cb));
+    submit(batch);
+}
+
+std::future<long> AsyncIO::read(int fd, void* buf, size_t len, long long offset)
+{
+    auto promise = std::make_shared<std::promise<long>>();
+    std::future<long> result = promise->get_future();
+    read(fd, buf, len, offset, [promise](long res) { promise->set_value(res); });
+    return result;
+}
+
+std::future<long> AsyncIO::write(int fd, const void* buf, size_t len, long long offset)
+{
+    auto promise = std::make_shared<std::promise<long>>();
+    std::future<long> result = promise->get_future();
+    write(fd, buf, len, offset, [promise](long res) { promise->set_value(res); });
+    return result;
+}
+
+void AsyncIO::submit(Batch& batch)
+{
+    enqueue(batch.reqs_);
+    batch.reqs_.clear();
+}
+
+void AsyncIO::enqueue(std::vector<Request*>& reqs)
+{
+    if(reqs.empty())
+        return;
+    Completions failed;
+    {
+        std::unique_lock<std::mutex>lock(mtx_);
+        inflight_ += reqs.size();
+        for(Request* req : reqs)
+            backlog_.push_back(req);
+        // io_uring: 整批写入提交队列 一次 io_uring_enter
+        if(usingIoUring())
+            flushBacklog(failed);
+        cond_.notify_all();
+    }
+    for(auto& f : failed)
+        complete(f.first, f.second);
+}
+
+void AsyncIO::complete(Request* req, long res)
+{
+    if(req->cb)
+    {
+        auto task = std::make_shared<IoCompleteTask>(std::move(req->cb), res);
+        // 线程池没运行 或 任务队列满 直接在当前线程执行回调
+        if(!post_(task))
+            task->run();
+    }
+    delete req;
+    inflight_--;
+}
+
+#ifdef ASYNCIO_URING
+bool AsyncIO::setupRing(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(fd < 0)
+        return false;
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(singleMmap)
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cqRing_ = singleMmap ? sqRing_ : mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqes_ = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED || sqes_ == MAP_FAILED)
+    {
+        std::cerr << "io_uring mmap failed, fall back to IO threads" << std::endl;
+        if(sqes_ != MAP_FAILED)
+            munmap(sqes_, sqesSize_);
+        if(!singleMmap && cqRing_ != MAP_FAILED)
+            munmap(cqRing_, cqRingSize_);
+        if(sqRing_ != MAP_FAILED)
+            munmap(sqRing_, sqRingSize_);
+        close(fd);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqRing_);
+    char* cq = static_cast<char*>(cqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = cq + params.cq_off.cqes;
+    sqEntries_ = params.sq_entries;
+    ringFd_ = fd;
+    return true;
+}
+
+// 把积压的请求写进提交队列 在途数量不超过 sqEntries_（完成队列是它的两倍 不会溢出）
+// 内核没有接收的请求从提交队列撤回 放进 failed 由调用方解锁后完成
+void AsyncIO::flushBacklog(Completions& failed)
+{
+    unsigned tail = *sqTail_; // 只有我们写 tail 有 mtx_ 保护
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    std::vector<Request*> batch;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(sqes_);
+    while(!backlog_.empty() && ringInflight_ < sqEntries_ && tail - head < sqEntries_)
+    {
+        Request* req = backlog_.front();
+        backlog_.pop_front();
+        unsigned idx = tail & *sqMask_;
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        req->iov.iov_base = req->buf;
+        req->iov.iov_len = req->len;
+        sqe->opcode = req->isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = req->fd;
+        sqe->addr = reinterpret_cast<unsigned long long>(&req->iov);
+        sqe->len = 1;
+        sqe->off = req->offset;
+        sqe->user_data = reinterpret_cast<unsigned long long>(req);
+        sqArray_[idx] = idx;
+        tail++;
+        batch.push_back(req);
+        ringInflight_++;
+    }
+    if(batch.empty())
+        return;
+    __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+    // 内核可能只接收一部分 剩下的继续提交
+    size_t submitted = 0;
+    int err = 0;
+    while(submitted < batch.size())
+    {
+        int ret = (int)syscall(__NR_io_uring_enter, ringFd_, (unsigned)(batch.size() - submitted), 0, 0, nullptr, 0);
+        if(ret > 0)
+            submitted += ret;
+        else if(ret < 0 && errno == EINTR)
+            continue;
+        else
+        {
+            err = ret < 0 ? errno : EAGAIN;
+            break;
+        }
+    }
+    if(submitted == batch.size())
+        return;
+    // 内核按顺序取 没取走的在提交队列末尾 撤回 tail 以 -errno 完成
+    size_t rest = batch.size() - submitted;
+    std::cerr << "io_uring_enter submit failed: " << strerror(err) << std::endl;
+    __atomic_store_n(sqTail_, tail - (unsigned)rest, __ATOMIC_RELEASE);
+    ringInflight_ -= rest;
+    for(size_t i = submitted; i < batch.size(); i++)
+        failed.emplace_back(batch[i], -(long)err);
+}
+
+// 收割完成队列 只有这一个线程读 cq head
+void AsyncIO::reapLoop()
+{
+    Completions done;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex>lock(mtx_);
+            cond_.wait(lock,[&]()->bool {
+                return ringInflight_ > 0 || (isExiting_ && backlog_.empty());
+            });
+            // 析构中 且 没有在途请求
+            if(ringInflight_ == 0)
+                return;
+        }
+        int ret = (int)syscall(__NR_io_uring_enter, ringFd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(ret < 0 && errno != EINTR)
+            std::cerr << "io_uring_enter wait failed: " << strerror(errno) << std::endl;
+
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        io_uring_cqe* cqes = static_cast<io_uring_cqe*>(cqes_);
+        while(head != tail)
+        {
+            io_uring_cqe* cqe = &cqes[head & *cqMask_];
+            done.emplace_back(reinterpret_cast<Request*>(cqe->user_data), cqe->res);
+            head++;
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        if(done.empty())
+            continue;
+        {
+            // 腾出了位置 继续提交积压的请求
+            std::unique_lock<std::mutex>lock(mtx_);
+            ringInflight_ -= done.size();
+            flushBacklog(done);
+        }
+        for(auto& d : done)
+            complete(d.first, d.second);
+        done.clear();
+    }
+}
+#else
+bool AsyncIO::setupRing(unsigned)
+{
+    return false;
+}
+void AsyncIO::flushBacklog(Completions&) {}
+void AsyncIO::reapLoop() {}
+#endif
+
+// 退化模式 IO线程阻塞执行读写
+void AsyncIO::offloadLoop()
+{
+    for(;;)
+    {
+        Request* req;
+        {
+            std::unique_lock<std::mutex>lock(mtx_);
+            cond_.wait(lock,[&]()->bool {
+                return !backlog_.empty() || isExiting_;
+            });
+            if(backlog_.empty())
+                return;
+            req = backlog_.front();
+            backlog_.pop_front();
+        }
+        long res;
+#ifdef _WIN32
+        {
+            // 没有 pread/pwrite 定位和读写要一起完成
+            static std::mutex seekMtx;
+            std::lock_guard<std::mutex>lock(seekMtx);
+            _lseeki64(req->fd, req->offset, SEEK_SET);
+            res = req->isWrite ? _write(req->fd, req->buf, (unsigned)req->len)
+                               : _read(req->fd, req->buf, (unsigned)req->len);
+        }
+        if(res < 0)
+            res = -errno;
+#else
+        ssize_t n;
+        do
+        {
+            n = req->isWrite ? pwrite(req->fd, req->buf, req->len, req->offset)
+                             : pread(req->fd, req->buf, req->len, req->offset);
+        } while(n < 0 && errno == EINTR);
+        res = n < 0 ? -errno : (long)n;
+#endif
+        complete(req, res);
+    }
+}
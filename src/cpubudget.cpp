@@ -0,0 +1,256 @@
+#include "cpubudget.h"
+#include<algorithm>
+#include<climits>
+#include<cmath>
+#include<exception>
+#include<fstream>
+#include<sstream>
+#include<string>
+#include<thread>
+#include<vector>
+#ifdef __linux__
+#include<sched.h>
+#endif
+
+#ifdef __linux__
+namespace
+{
+bool readFirstLine(const std::string& file, std::string& line)
+{
+    std::ifstream in(file);
+    return in && std::getline(in, line);
+}
+
+// "cpu,cpuacct" / "rw,cpu,cpuacct" 里是否有 name
+bool hasController(const std::string& list, const std::string& name)
+{
+    std::istringstream in(list);
+    std::string item;
+    while(std::getline(in, item, ','))
+    {
+        if(item == name)
+            return true;
+    }
+    return false;
+}
+
+// cpuset 列表 "0-3,8,10-11" 中的 CPU 数 格式不对返回0（当作没有限制）
+int countCpuList(const std::string& list)
+{
+    int count = 0;
+    std::istringstream in(list);
+    std::string item;
+    try
+    {
+        while(std::getline(in, item, ','))
+        {
+            if(item.empty())
+                continue;
+            size_t dash = item.find('-');
+            if(dash == std::string::npos)
+                count++;
+            else
+                count += std::stoi(item.substr(dash + 1)) - std::stoi(item.substr(0, dash)) + 1;
+        }
+    }
+    catch(const std::exception&)
+    {
+        return 0;
+    }
+    return count > 0 ? count : 0;
+}
+
+// 当前进程所在的 cgroup 目录 从自己一直到层级的挂载点（上层的限制也要算）
+// controller 为空时找 cgroup v2 否则找包含该 controller 的 v1 层级 找不到返回空
+std::vector<std::string> cgroupDirs(const std::string& controller)
+{
+    bool v2 = controller.empty();
+    // /proc/self/cgroup 每行 "层级id:controller列表:路径" v2 是 "0::路径"
+    std::ifstream cgroup("/proc/self/cgroup");
+    std::string line, path;
+    bool found = false;
+    while(!found && std::getline(cgroup, line))
+    {
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if(first == std::string::npos || second == std::string::npos)
+            continue;
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        if(v2 ? (line.compare(0, first, "0") == 0 && controllers.empty()) : hasController(controllers, controller))
+        {
+            path = line.substr(second + 1);
+            found = true;
+        }
+    }
+    if(!found)
+        return {};
+    // /proc/self/mountinfo 每行 "id parent dev root 挂载点 选项 ... - 类型 来源 超级块选项"
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    std::string mount, root;
+    while(mount.empty() && std::getline(mountinfo, line))
+    {
+        size_t sep = line.find(" - ");
+        if(sep == std::string::npos)
+            continue;
+        std::istringstream head(line.substr(0, sep)), tail(line.substr(sep + 3));
+        std::string id, parent, dev, mroot, point, fstype, source, options;
+        head >> id >> parent >> dev >> mroot >> point;
+        tail >> fstype >> source >> options;
+        if(v2 ? fstype == "cgroup2" : (fstype == "cgroup" && hasController(options, controller)))
+        {
+            mount = point;
+            root = mroot;
+        }
+    }
+    if(mount.empty())
+        return {};
+    // 挂载的不是层级根目录时（容器）进程路径要去掉挂载的 root 部分
+    if(root != "/" && path.compare(0, root.size(), root) == 0)
+        path = path.substr(root.size());
+    std::vector<std::string> dirs;
+    while(!path.empty() && path != "/")
+    {
+        dirs.push_back(mount + path);
+        path = path.substr(0, path.rfind('/'));
+    }
+    dirs.push_back(mount);
+    return dirs;
+}
+
+// 配额 沿路径取最小 没有限制返回0 解析不了的文件跳过
+double readQuota()
+{
+    double quota = 0;
+    auto limit = [&quota](double cpus) {
+        if(cpus > 0 && (quota == 0 || cpus < quota))
+            quota = cpus;
+    };
+    std::string line;
+    // v2 cpu.max "max 100000" 或 "150000 100000"
+    for(auto& dir : cgroupDirs(""))
+    {
+        if(!readFirstLine(dir + "/cpu.max", line))
+            continue;
+        std::istringstream in(line);
+        std::string max;
+        long long period = 0;
+        in >> max >> period;
+        if(max != "max" && period > 0)
+        {
+            try
+            {
+                limit(std::stod(max) / period);
+            }
+            catch(const std::exception&) {}
+        }
+    }
+    if(quota > 0)
+        return quota;
+    // v1 cpu.cfs_quota_us 为 -1 表示没有限制
+    for(auto& dir : cgroupDirs("cpu"))
+    {
+        std::string period;
+        if(!readFirstLine(dir + "/cpu.cfs_quota_us", line) || !readFirstLine(dir + "/cpu.cfs_period_us", period))
+            continue;
+        try
+        {
+            long long q = std::stoll(line), p = std::stoll(period);
+            if(q > 0 && p > 0)
+                limit((double)q / p);
+        }
+        catch(const std::exception&) {}
+    }
+    return quota;
+}
+
+// cpuset 的 effective 文件已经包含了上层的限制 只看最里层
+int readCpuset()
+{
+    std::string line;
+    auto dirs = cgroupDirs("");
+    if(!dirs.empty() && readFirstLine(dirs.front() + "/cpuset.cpus.effective", line) && !line.empty())
+        return countCpuList(line);
+    dirs = cgroupDirs("cpuset");
+    if(!dirs.empty())
+    {
+        if((readFirstLine(dirs.front() + "/cpuset.effective_cpus", line) && !line.empty())
+            || (readFirstLine(dirs.front() + "/cpuset.cpus", line) && !line.empty()))
+            return countCpuList(line);
+    }
+    return 0;
+}
+
+int readAffinity()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) != 0)
+        return 0;
+    return CPU_COUNT(&set);
+}
+
+// 解析 cpu.stat 有 nr_periods（启用了 cpu controller）才算读到
+bool readCpuStat(const std::string& file, CpuThrottle& stat)
+{
+    std::ifstream in(file);
+    std::string key;
+    long long value;
+    bool found = false;
+    while(in >> key >> value)
+    {
+        if(key == "nr_periods")
+        {
+            stat.periods = value;
+            found = true;
+        }
+        else if(key == "nr_throttled")
+            stat.throttled = value;
+        else if(key == "throttled_usec") // v2
+            stat.throttledUsec = value;
+        else if(key == "throttled_time") // v1 纳秒
+            stat.throttledUsec = value / 1000;
+    }
+    return found;
+}
+}
+#endif
+
+int CpuBudget::threads() const
+{
+    int n = INT_MAX;
+    for(int limit : {hardware, affinity, cpuset})
+    {
+        if(limit > 0)
+            n = std::min(n, limit);
+    }
+    if(quota > 0)
+        n = std::min(n, (int)std::ceil(quota));
+    return n == INT_MAX ? 1 : std::max(n, 1);
+}
+
+CpuBudget CpuBudget::detect()
+{
+    CpuBudget budget;
+    budget.hardware = (int)std::thread::hardware_concurrency();
+#ifdef __linux__
+    budget.affinity = readAffinity();
+    budget.cpuset = readCpuset();
+    budget.quota = readQuota();
+#endif
+    return budget;
+}
+
+CpuThrottle CpuThrottle::read()
+{
+    CpuThrottle stat;
+#ifdef __linux__
+    auto dirs = cgroupDirs("");
+    if(!dirs.empty() && readCpuStat(dirs.front() + "/cpu.stat", stat))
+        return stat;
+    stat = CpuThrottle();
+    dirs = cgroupDirs("cpu");
+    if(!dirs.empty())
+        readCpuStat(dirs.front() + "/cpu.stat", stat);
+#endif
+    return stat;
+}
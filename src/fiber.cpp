@@ -0,0 +1,217 @@
+#include "fiber.h"
+#include "threadpool.h"
+#include<iostream>
+#include<vector>
+#ifndef _WIN32
+#include<sys/mman.h>
+#include<unistd.h>
+
+namespace
+{
+size_t pageSize()
+{
+    static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+// 工作线程的调度状态
+struct FiberWorker
+{
+    ucontext_t ctx; // 工作线程自己的上下文 fiber 挂起/结束时切回这里
+    Fiber* current = nullptr;
+    std::mutex* pendingUnlock = nullptr; // 切回工作线程后再释放的锁
+    std::vector<std::pair<void*, size_t>> stacks; // 空闲栈缓存
+
+    ~FiberWorker()
+    {
+        for(auto& stack : stacks)
+            munmap(stack.first, stack.second);
+    }
+    void* takeStack(size_t bytes)
+    {
+        while(!stacks.empty())
+        {
+            auto stack = stacks.back();
+            stacks.pop_back();
+            if(stack.second == bytes)
+                return stack.first;
+            munmap(stack.first, stack.second);
+        }
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if(p == MAP_FAILED)
+            return nullptr;
+        // 最低一页做保护页 栈溢出时直接崩溃而不是写坏别的内存
+        mprotect(p, pageSize(), PROT_NONE);
+        return p;
+    }
+    void putStack(void* stack, size_t bytes)
+    {
+        if(stacks.size() < FIBER_STACK_CACHE)
+            stacks.emplace_back(stack, bytes);
+        else
+            munmap(stack, bytes);
+    }
+};
+
+thread_local FiberWorker tlsWorker;
+
+// fiber 挂起后可能在另一个线程上恢复 编译器不能把线程局部变量的地址缓存到挂起点之后
+// 所以每次都通过这个不内联、有副作用的函数重新取
+__attribute__((noinline)) FiberWorker& worker()
+{
+    FiberWorker* w = &tlsWorker;
+    asm volatile("" : "+r"(w));
+    return *w;
+}
+}
+
+bool Fiber::start(std::shared_ptr<Task> task, size_t stackSize, Resumer* resumer)
+{
+    size_t bytes = reservedStackSize(stackSize);
+    void* stack = worker().takeStack(bytes);
+    if(stack == nullptr)
+    {
+        // 分配不到栈 直接在工作线程上执行
+        std::cerr << "fiber stack mmap failed, run task on worker thread" << std::endl;
+        task->exec();
+        return true;
+    }
+    Fiber* fiber = new Fiber();
+    fiber->task_ = std::move(task);
+    fiber->resumer_ = resumer;
+    fiber->stack_ = stack;
+    fiber->stackBytes_ = bytes;
+    getcontext(&fiber->ctx_);
+    fiber->ctx_.uc_stack.ss_sp = static_cast<char*>(stack) + pageSize();
+    fiber->ctx_.uc_stack.ss_size = bytes - pageSize();
+    fiber->ctx_.uc_link = nullptr;
+    makecontext(&fiber->ctx_, &Fiber::entry, 0);
+    return switchTo(fiber);
+}
+
+bool Fiber::resume(Fiber* fiber)
+{
+    return switchTo(fiber);
+}
+
+bool Fiber::switchTo(Fiber* fiber)
+{
+    // 这里一直在工作线程自己的栈上 不会换线程
+    FiberWorker& w = worker();
+    w.current = fiber;
+    swapcontext(&w.ctx, &fiber->ctx_);
+    w.current = nullptr;
+    // 解锁之后 fiber 可能已经被别的线程恢复甚至执行完释放 先读出状态
+    bool done = fiber->done_;
+    if(w.pendingUnlock != nullptr)
+    {
+        w.pendingUnlock->unlock();
+        w.pendingUnlock = nullptr;
+    }
+    if(!done)
+        return false;
+    w.putStack(fiber->stack_, fiber->stackBytes_);
+    delete fiber;
+    return true;
+}
+
+void Fiber::entry()
+{
+    Fiber* self = current();
+    self->task_->exec();
+    self->task_.reset();
+    self->done_ = true;
+    // 结束时所在的工作线程不一定是开始时的那个
+    setcontext(&worker().ctx);
+}
+
+Fiber* Fiber::current()
+{
+    return worker().current;
+}
+
+void Fiber::suspend(std::unique_lock<std::mutex>& lock)
+{
+    Fiber* self = current();
+    // 只把 mutex 交给工作线程解锁 unique_lock 在 fiber 栈上
+    // 解锁后 fiber 可能马上在别的线程恢复 工作线程不能再碰它
+    std::mutex* mtx = lock.release();
+    worker().pendingUnlock = mtx;
+    swapcontext(&self->ctx_, &worker().ctx);
+    // 被唤醒 可能已经在另一个工作线程上
+    lock = std::unique_lock<std::mutex>(*mtx);
+}
+
+void Fiber::wake(Fiber* fiber)
+{
+    (*fiber->resumer_)(fiber);
+}
+
+Arena* Fiber::currentArena()
+{
+    Fiber* self = current();
+    if(self == nullptr)
+        return nullptr;
+    if(!self->arena_)
+        self->arena_.reset(new Arena(FIBER_ARENA_BLOCK));
+    return self->arena_.get();
+}
+
+size_t Fiber::reservedStackSize(size_t stackSize)
+{
+    size_t page = pageSize();
+    return (stackSize + page - 1) / page * page + page;
+}
+
+#else
+// Windows 没有 ucontext 任务直接在工作线程上执行
+bool Fiber::start(std::shared_ptr<Task> task, size_t stackSize, Resumer* resumer)
+{
+    (void)stackSize;
+    (void)resumer;
+    task->exec();
+    return true;
+}
+
+bool Fiber::resume(Fiber* fiber)
+{
+    (void)fiber;
+    return true;
+}
+
+bool Fiber::switchTo(Fiber* fiber)
+{
+    (void)fiber;
+    return true;
+}
+
+void Fiber::entry()
+{
+
+}
+
+Fiber* Fiber::current()
+{
+    return nullptr;
+}
+
+void Fiber::suspend(std::unique_lock<std::mutex>& lock)
+{
+    (void)lock;
+}
+
+void Fiber::wake(Fiber* fiber)
+{
+    (void)fiber;
+}
+
+size_t Fiber::reservedStackSize(size_t stackSize)
+{
+    return stackSize;
+}
+
+Arena* Fiber::currentArena()
+{
+    return nullptr;
+}
+#endif
@@ -1,6 +1,21 @@
 #include <iostream>
 #include<chrono>
+#include<cstring>
+#include<numeric>
+#include<random>
 #include "threadpool.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "shmqueue.h"
+#include "singleflight.h"
+#ifdef __linux__
+#include<sys/wait.h>
+#include<unistd.h>
+#endif
+// std::execution::par 对比需要 TBB: make CXXFLAGS="-std=c++17 -O2 -DBENCH_STD_PAR" LFLAGS=-ltbb
+#ifdef BENCH_STD_PAR
+#include<execution>
+#endif
 
 using namespace std;
 using uLong =unsigned long long;
@@ -23,8 +38,423 @@ class MyTask : public Task
         int begin_;
         int end_;
 };
+// 计时工具 返回毫秒
+template<typename Func>
+double timeIt(Func&& func)
+{
+    auto begin = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double,std::milli>(end-begin).count();
+}
+// 测性能用的线程池 不打印日志（ThreadPool 的 TracingStats 每个任务打印三行 会算进计时）
+using BenchPool = BasicThreadPool<UnboundedQueue,NotifyOneWait,FixedGrowth,NoStats>;
+// 并行算法 vs 串行 std:: 算法 vs std::execution::par
+// ./output/main bench-parallel
+void benchParallel()
+{
+    const size_t N = 1 << 25;
+    vector<double> data(N);
+    mt19937 gen(42);
+    uniform_real_distribution<double> dist(0.0,1.0);
+    for(auto& d : data) d = dist(gen);
+    BenchPool pool;
+    pool.start();
+    double s1=0,s2=0,s3=0;
+    cout<<"reduce std::accumulate   "<<timeIt([&]{ s1 = accumulate(data.begin(),data.end(),0.0); })<<" ms"<<endl;
+    cout<<"reduce parallelReduce    "<<timeIt([&]{ s2 = parallelReduce(pool,data.begin(),data.end(),0.0); })<<" ms"<<endl;
+#ifdef BENCH_STD_PAR
+    cout<<"reduce std::execution::par "<<timeIt([&]{ s3 = reduce(execution::par,data.begin(),data.end(),0.0); })<<" ms"<<endl;
+#endif
+    cout<<"sum "<<s1<<" "<<s2<<" "<<s3<<endl;
+
+    vector<double> out(N);
+    cout<<"scan std::inclusive_scan "<<timeIt([&]{ inclusive_scan(data.begin(),data.end(),out.begin()); })<<" ms"<<endl;
+    cout<<"scan parallelInclusiveScan "<<timeIt([&]{ parallelInclusiveScan(pool,data.begin(),data.end(),out.begin()); })<<" ms"<<endl;
+#ifdef BENCH_STD_PAR
+    cout<<"scan std::execution::par "<<timeIt([&]{ inclusive_scan(execution::par,data.begin(),data.end(),out.begin()); })<<" ms"<<endl;
+#endif
+
+    vector<double> a(data), b(data), c(data);
+    cout<<"sort std::sort           "<<timeIt([&]{ sort(a.begin(),a.end()); })<<" ms"<<endl;
+    cout<<"sort parallelSort        "<<timeIt([&]{ parallelSort(pool,b.begin(),b.end()); })<<" ms"<<endl;
+#ifdef BENCH_STD_PAR
+    cout<<"sort std::execution::par "<<timeIt([&]{ sort(execution::par,c.begin(),c.end()); })<<" ms"<<endl;
+#endif
+}
+// 三阶段流水线吞吐: 生成 -> 变换 -> 求和
+// ./output/main bench-pipeline
+void benchPipeline()
+{
+    const long N = 20000000;
+    BenchPool pool;
+    pool.start(4);
+    Channel<long> c1, c2;
+    Pipeline pipe(pool);
+    long next = 0;
+    atomic<long> sum(0);
+    pipe.addSource(c1,[&](long& x) {
+        if(next >= N) return false;
+        x = next++;
+        return true;
+    });
+    pipe.addStage(c1,c2,2,[](long& x) { return x * 2; });
+    pipe.addSink(c2,1,[&](long& x) { sum.fetch_add(x,memory_order_relaxed); });
+    double ms = timeIt([&]{ pipe.run(); });
+    cout<<"pipeline "<<N<<" items "<<ms<<" ms, "<<N / ms / 1000<<" M items/s, sum "<<sum<<endl;
+}
+// 空任务 测线程池本身的开销
+class CountTask : public Task
+{
+public:
+    CountTask(atomic<long>& counter):counter_(counter){}
+    Any run()
+    {
+        counter_.fetch_add(1,memory_order_relaxed);
+        return Any();
+    }
+private:
+    atomic<long>& counter_;
+};
+template<typename Pool>
+double benchSubmit(long n)
+{
+    Pool pool;
+    pool.start(4);
+    atomic<long> counter(0);
+    return timeIt([&]{
+        for(long i=0;i<n;i++)
+            pool.submit(make_shared<CountTask>(counter));
+        while(counter.load() < n)
+            this_thread::yield();
+    });
+}
+// 最小配置 vs 全功能配置（不打印日志）的提交+执行开销
+// ./output/main bench-policy
+void benchPolicy()
+{
+    const long N = 1000000;
+    using MinimalPool = BasicThreadPool<UnboundedQueue,NotifyOneWait,FixedGrowth,NoStats>;
+    using SpinPool = BasicThreadPool<UnboundedQueue,SpinThenBlockWait<64>,FixedGrowth,NoStats>;
+    using FullPool = BasicThreadPool<BoundedQueue,BlockingWait,RuntimeGrowth,CountingStats>;
+    double minimal = benchSubmit<MinimalPool>(N);
+    double spin = benchSubmit<SpinPool>(N);
+    double full = benchSubmit<FullPool>(N);
+    cout<<"minimal "<<minimal<<" ms, "<<minimal * 1e6 / N<<" ns/task"<<endl;
+    cout<<"spin    "<<spin<<" ms, "<<spin * 1e6 / N<<" ns/task"<<endl;
+    cout<<"full    "<<full<<" ms, "<<full * 1e6 / N<<" ns/task"<<endl;
+}
+// 任务需要一张查找表和一块临时缓冲区: 每个任务自己创建 vs 工作线程私有
+// ./output/main bench-worker-local
+struct LookupTable
+{
+    LookupTable():table(1 << 16)
+    {
+        for(size_t i=0;i<table.size();i++)
+            table[i] = (uint32_t)(i * 2654435761u);
+    }
+    vector<uint32_t> table;
+};
+class ScratchTask : public Task
+{
+public:
+    ScratchTask(bool useContext,atomic<long>& counter):useContext_(useContext),counter_(counter){}
+    Any run()
+    {
+        const size_t n = 4096;
+        uint64_t sum = 0;
+        if(useContext_)
+        {
+            WorkerContext* ctx = WorkerContext::current();
+            LookupTable& lut = ctx->local<LookupTable>();
+            uint32_t* buf = ctx->arena().allocArray<uint32_t>(n);
+            for(size_t i=0;i<n;i++)
+                buf[i] = lut.table[i & 0xffff];
+            for(size_t i=0;i<n;i++)
+                sum += buf[i];
+        }
+        else
+        {
+            LookupTable lut;
+            vector<uint32_t> buf(n);
+            for(size_t i=0;i<n;i++)
+                buf[i] = lut.table[i & 0xffff];
+            for(size_t i=0;i<n;i++)
+                sum += buf[i];
+        }
+        counter_.fetch_add(1,memory_order_relaxed);
+        return sum;
+    }
+private:
+    bool useContext_;
+    atomic<long>& counter_;
+};
+void benchWorkerLocal()
+{
+    const long N = 20000;
+    BenchPool pool;
+    pool.start(4);
+    for(bool useContext : {false,true})
+    {
+        atomic<long> counter(0);
+        double ms = timeIt([&]{
+            for(long i=0;i<N;i++)
+                pool.submit(make_shared<ScratchTask>(useContext,counter));
+            while(counter.load() < N)
+                this_thread::yield();
+        });
+        cout<<(useContext ? "worker-local " : "per-task     ")<<ms<<" ms, "<<ms * 1e6 / N<<" ns/task"<<endl;
+    }
+}
+// fiber 模式: N 个任务都先报到再等放行 只有 4 个工作线程
+// 普通模式下最多 4 个任务能开始 主线程永远等不齐报到
+// ./output/main bench-fiber
+class GateTask : public Task
+{
+public:
+    GateTask(Semaphore& arrived,Semaphore& gate,FiberMutex& mtx,long& total)
+    :arrived_(arrived),gate_(gate),mtx_(mtx),total_(total){}
+    Any run()
+    {
+        arrived_.post();
+        gate_.wait();
+        lock_guard<FiberMutex> lock(mtx_);
+        total_++;
+        return Any();
+    }
+private:
+    Semaphore& arrived_;
+    Semaphore& gate_;
+    FiberMutex& mtx_;
+    long& total_;
+};
+void benchFiber()
+{
+    const int N = 10000;
+    BasicThreadPool<UnboundedQueue,NotifyOneWait,FixedGrowth,CountingStats> pool;
+    pool.setFiberMode(16 * 1024);
+    pool.start(4);
+    Semaphore arrived, gate;
+    FiberMutex mtx;
+    long total = 0;
+    vector<unique_ptr<Result>> results;
+    double ms = timeIt([&]{
+        for(int i=0;i<N;i++)
+            results.emplace_back(new Result(pool.submit(make_shared<GateTask>(arrived,gate,mtx,total))));
+        for(int i=0;i<N;i++)
+            arrived.wait();
+        PoolMemoryStats mem = pool.memoryUsage();
+        cout<<"blocked fibers "<<mem.liveFibers<<" on "<<pool.getCurThreadSize()<<" threads, stacks "
+            <<mem.fiberStackBytes / 1024<<" KB"<<endl;
+        for(int i=0;i<N;i++)
+            gate.post();
+        for(auto& rs : results)
+            rs->get();
+    });
+    cout<<"total "<<total<<", "<<ms<<" ms"<<endl;
+}
+// 打印进程可用的 CPU 和 cgroup 限流统计 以及默认线程数
+// ./output/main cpu-budget
+void showCpuBudget()
+{
+    BenchPool pool;
+    pool.start();
+    CpuBudget budget = pool.cpuBudget();
+    cout<<"hardware "<<budget.hardware<<", affinity "<<budget.affinity<<", cpuset "<<budget.cpuset
+        <<", quota "<<budget.quota<<" -> "<<pool.getCurThreadSize()<<" threads"<<endl;
+    CpuThrottle throttle = pool.cpuThrottle();
+    cout<<"throttled "<<throttle.throttled<<"/"<<throttle.periods<<" periods, "
+        <<throttle.throttledUsec / 1000<<" ms"<<endl;
+}
+// 1000 个请求只有 10 个不同的 key 每个计算 20ms
+// ./output/main bench-singleflight
+class SlowSquare : public Task
+{
+public:
+    SlowSquare(int n):n_(n){}
+    Any run()
+    {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        return n_ * n_;
+    }
+private:
+    int n_;
+};
+void benchSingleFlight()
+{
+    const int N = 1000, KEYS = 10;
+    BasicThreadPool<UnboundedQueue,NotifyOneWait,CachedGrowth,CountingStats> pool;
+    pool.start(4);
+    pool.singleFlight().setCache(64, chrono::milliseconds(500));
+    long long sum = 0;
+    double ms = timeIt([&]{
+        for(int round=0;round<2;round++)
+        {
+            vector<unique_ptr<Result>> results;
+            for(int i=0;i<N;i++)
+                results.emplace_back(new Result(pool.singleFlight().submit("square:" + to_string(i % KEYS),make_shared<SlowSquare>(i % KEYS))));
+            for(auto& rs : results)
+                sum += rs->get().cast_<int>();
+        }
+    });
+    SingleFlightStats stats = pool.singleFlight().stats();
+    cout<<"sum "<<sum<<", "<<ms<<" ms: executed "<<stats.executed<<", coalesced "<<stats.coalesced
+        <<", cache hits "<<stats.hits<<endl;
+}
+// 三个租户同时塞满队列: flow 1 权重3、flow 2 权重1 各自上限200；flow 0 没有 setFlow 用默认值（总上限的一半）
+// ./output/main bench-fair
+class SpinTask : public Task
+{
+public:
+    Any run()
+    {
+        auto end = chrono::steady_clock::now() + chrono::microseconds(200);
+        while(chrono::steady_clock::now() < end);
+        return Any();
+    }
+};
+void benchFair()
+{
+    const int FLOWS[] = {1, 2, 0};
+    FairThreadPool pool;
+    pool.setTaskQueMaxSize(500);
+    pool.setFlow(1, 3, 200);
+    pool.setFlow(2, 1, 200);
+    pool.start(2);
+    atomic<bool> stop(false);
+    vector<thread> tenants;
+    for(int flow : FLOWS)
+    {
+        // 不等待空位 队列满就算一次拒绝
+        tenants.emplace_back([&pool,&stop,flow]{
+            while(!stop)
+            {
+                if(!pool.trySubmit(make_shared<SpinTask>(),flow).isValid())
+                    this_thread::yield();
+            }
+        });
+    }
+    this_thread::sleep_for(chrono::milliseconds(500));
+    FlowStats stats[3];
+    long long total = 0;
+    for(int i=0;i<3;i++)
+    {
+        stats[i] = pool.flowStats(FLOWS[i]);
+        total += stats[i].dequeued;
+    }
+    stop = true;
+    for(auto& t : tenants)
+        t.join();
+    for(int i=0;i<3;i++)
+    {
+        cout<<"flow "<<FLOWS[i]<<" weight "<<stats[i].weight<<", max queued "<<stats[i].maxQueued
+            <<": executed "<<stats[i].dequeued<<" ("<<(total > 0 ? stats[i].dequeued * 100 / total : 0)<<"%), queued "
+            <<stats[i].queued<<", rejected "<<stats[i].rejected<<endl;
+    }
+}
+#ifdef __linux__
+// 本机两进程: 父进程持有线程池做服务端 子进程通过共享内存提交任务
+// ./output/main bench-shm
+void benchShm()
+{
+    const char* name = "/threadpool_bench";
+    const int N = 100000;
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        ShmTaskClient client;
+        while(!client.connect(name))
+            this_thread::sleep_for(chrono::milliseconds(1));
+        ShmCompletion done;
+        long value = 0;
+        // 同步往返延迟
+        double sync = timeIt([&]{
+            for(int i=0;i<N;i++)
+            {
+                client.submit(1,&value,sizeof(value));
+                client.wait(done);
+                memcpy(&value,done.data.data(),sizeof(value));
+            }
+        });
+        // 批量流水提交吞吐
+        const int WINDOW = 512;
+        double pipelined = timeIt([&]{
+            for(int i=0;i<N;i+=WINDOW)
+            {
+                for(int j=0;j<WINDOW;j++)
+                    client.submit(1,&value,sizeof(value));
+                for(int j=0;j<WINDOW;j++)
+                    client.wait(done);
+            }
+        });
+        cout<<"shm round trip "<<sync * 1000 / N<<" us/task, value "<<value<<endl;
+        cout<<"shm pipelined  "<<N / pipelined / 1000<<" M tasks/s"<<endl;
+        _exit(0);
+    }
+    BenchPool pool;
+    pool.start();
+    ShmTaskServer server(pool,name);
+    // kind 1: 数字加1
+    server.registerHandler(1,[](const char* data, size_t len, string& out) -> int {
+        long v = 0;
+        memcpy(&v,data,min(len,sizeof(v)));
+        v++;
+        out.assign(reinterpret_cast<const char*>(&v),sizeof(v));
+        return 0;
+    });
+    server.start();
+    waitpid(pid,nullptr,0);
+}
+#endif
 int main(int argc, char *argv[])
 {
+#ifdef __linux__
+    if(argc > 1 && strcmp(argv[1],"bench-shm") == 0)
+    {
+        benchShm();
+        return 0;
+    }
+#endif
+    if(argc > 1 && strcmp(argv[1],"bench-policy") == 0)
+    {
+        benchPolicy();
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1],"bench-parallel") == 0)
+    {
+        benchParallel();
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1],"bench-pipeline") == 0)
+    {
+        benchPipeline();
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1],"bench-worker-local") == 0)
+    {
+        benchWorkerLocal();
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1],"bench-fiber") == 0)
+    {
+        benchFiber();
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1],"cpu-budget") == 0)
+    {
+        showCpuBudget();
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1],"bench-singleflight") == 0)
+    {
+        benchSingleFlight();
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1],"bench-fair") == 0)
+    {
+        benchFair();
+        return 0;
+    }
     {
         ThreadPool pool;
         pool.setMode(PoolMode::MODE_CACHED);
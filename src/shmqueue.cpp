@@ -0,0 +1,446 @@
+#include "shmqueue.h"
+#ifdef __linux__
+#include<algorithm>
+#include<cerrno>
+#include<cstddef>
+#include<chrono>
+#include<climits>
+#include<cstring>
+#include<iostream>
+#include<vector>
+#include<fcntl.h>
+#include<linux/futex.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/syscall.h>
+#include<unistd.h>
+
+namespace
+{
+const uint32_t SHM_MAGIC = 0x54504f4c; // 共享内存初始化完成的标记
+const int SHM_SPIN_COUNT = 200; // futex 睡眠前的自旋次数
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "need lock-free 64-bit atomics in shared memory");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "need lock-free 32-bit atomics in shared memory");
+static_assert((SHM_RING_SIZE & (SHM_RING_SIZE - 1)) == 0, "SHM_RING_SIZE must be a power of 2");
+
+// 一条请求 / 结果
+struct Message
+{
+    uint64_t id;
+    uint32_t kind;
+    int32_t status;
+    uint32_t len;
+    char data[SHM_PAYLOAD_SIZE];
+};
+
+struct Slot
+{
+    std::atomic<uint64_t> seq;
+    Message msg;
+};
+
+// 共享内存里的有界 MPMC 环形队列 每个槽位带序号
+// futexWord 每次入队加1 消费者睡在它上面
+struct Ring
+{
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint32_t> futexWord;
+    std::atomic<uint32_t> waiters;
+    Slot slots[SHM_RING_SIZE];
+
+    void init()
+    {
+        head.store(0);
+        tail.store(0);
+        futexWord.store(0);
+        waiters.store(0);
+        for(uint32_t i = 0; i < SHM_RING_SIZE; i++)
+            slots[i].seq.store(i);
+    }
+};
+}
+
+// 一个通道的共享内存布局
+struct ShmSegment
+{
+    std::atomic<uint32_t> magic;
+    std::atomic<uint64_t> nextId; // 请求id 从1开始
+    Ring submitQ; // 客户端 -> 服务端
+    Ring completeQ; // 服务端 -> 客户端
+};
+
+namespace
+{
+int futexWait(std::atomic<uint32_t>* addr, uint32_t val, const timespec* timeout)
+{
+    // 跨进程 不能用 FUTEX_PRIVATE_FLAG
+    return (int)syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, val, timeout, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t>* addr)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+bool tryPush(Ring& ring, const Message& msg)
+{
+    uint64_t pos = ring.tail.load(std::memory_order_relaxed);
+    Slot* slot;
+    for(;;)
+    {
+        slot = &ring.slots[pos & (SHM_RING_SIZE - 1)];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t dif = (int64_t)seq - (int64_t)pos;
+        if(dif == 0)
+        {
+            if(ring.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(dif < 0)
+            return false;
+        else
+            pos = ring.tail.load(std::memory_order_relaxed);
+    }
+    memcpy(&slot->msg, &msg, offsetof(Message, data) + msg.len);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool tryPop(Ring& ring, Message& msg)
+{
+    uint64_t pos = ring.head.load(std::memory_order_relaxed);
+    Slot* slot;
+    for(;;)
+    {
+        slot = &ring.slots[pos & (SHM_RING_SIZE - 1)];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t dif = (int64_t)seq - (int64_t)(pos + 1);
+        if(dif == 0)
+        {
+            if(ring.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(dif < 0)
+            return false;
+        else
+            pos = ring.head.load(std::memory_order_relaxed);
+    }
+    // len 由对端进程写入 不可信：先拷贝消息头 只用拷贝出来的 len 且最多拷贝 SHM_PAYLOAD_SIZE
+    // 超长的 len 原样留在 msg.len 里 由使用方拒绝
+    memcpy(&msg, &slot->msg, offsetof(Message, data));
+    memcpy(msg.data, slot->msg.data, std::min<size_t>(msg.len, SHM_PAYLOAD_SIZE));
+    slot->seq.store(pos + SHM_RING_SIZE, std::memory_order_release);
+    return true;
+}
+
+// 唤醒睡在队列上的消费者
+void notify(Ring& ring)
+{
+    ring.futexWord.fetch_add(1);
+    if(ring.waiters.load() > 0)
+        futexWake(&ring.futexWord);
+}
+
+// 队列满时的退避 先自旋 再短睡
+void backoff(int spins)
+{
+    if(spins >= SHM_SPIN_COUNT)
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+}
+
+// 入队 队列满时退避等待；running 变成 false 时放弃 返回false
+bool push(Ring& ring, const Message& msg, const std::atomic_bool* running)
+{
+    for(int spins = 0; !tryPush(ring, msg); spins++)
+    {
+        if(running != nullptr && !running->load())
+            return false;
+        backoff(spins);
+    }
+    notify(ring);
+    return true;
+}
+
+// 队列中的元素数 先读 head 再读 tail 结果只会偏大；对端写坏的值按满处理
+uint64_t occupied(Ring& ring)
+{
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    uint64_t tail = ring.tail.load(std::memory_order_acquire);
+    return tail - head > SHM_RING_SIZE ? SHM_RING_SIZE : tail - head;
+}
+
+// 出队 先自旋 再 futex 睡眠
+// timeoutMs < 0 一直等；running 变成 false 时返回
+bool popWait(Ring& ring, Message& msg, int timeoutMs, const std::atomic_bool* running)
+{
+    for(int i = 0; i < SHM_SPIN_COUNT; i++)
+    {
+        if(tryPop(ring, msg))
+            return true;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    for(;;)
+    {
+        uint32_t word = ring.futexWord.load();
+        if(tryPop(ring, msg))
+            return true;
+        if(running != nullptr && !running->load())
+            return false;
+        timespec ts;
+        timespec* pts = nullptr;
+        if(timeoutMs >= 0)
+        {
+            auto left = deadline - std::chrono::steady_clock::now();
+            if(left <= std::chrono::nanoseconds(0))
+                return false;
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            pts = &ts;
+        }
+        // 读 word 之后有新数据入队 word 已经变化 futexWait 会立即返回
+        ring.waiters.fetch_add(1);
+        futexWait(&ring.futexWord, word, pts);
+        ring.waiters.fetch_sub(1);
+    }
+}
+
+std::string shmName(const std::string& name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+// 分发给线程池的一批请求
+class ShmDispatchTask : public Task
+{
+public:
+    ShmDispatchTask(ShmTaskServer* server, std::vector<Message>&& msgs, std::atomic_int& pending)
+    :server_(server),msgs_(std::move(msgs)),pending_(pending){}
+    Any run()
+    {
+        for(auto& msg : msgs_)
+            server_->process(msg.kind, msg.id, msg.data, msg.len);
+        pending_--;
+        return Any();
+    }
+private:
+    ShmTaskServer* server_;
+    std::vector<Message> msgs_;
+    std::atomic_int& pending_;
+};
+}
+
+ShmTaskServer::ShmTaskServer(TaskPoster post, const std::string& name)
+:post_(std::move(post))
+,name_(shmName(name))
+,seg_(nullptr)
+,isRunning_(false)
+,pending_(0)
+,outstanding_(0)
+{
+
+}
+
+ShmTaskServer::~ShmTaskServer()
+{
+    if(seg_ == nullptr)
+        return;
+    isRunning_ = false;
+    notify(seg_->submitQ);
+    if(dispatcher_.joinable())
+        dispatcher_.join();
+    // 等待已分发的任务执行完 它们还要访问共享内存
+    // 停止后写不进完成队列的结果直接丢弃（push 返回false）所以这里只等处理函数本身
+    while(pending_ > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    munmap(seg_, sizeof(ShmSegment));
+    shm_unlink(name_.c_str());
+}
+
+void ShmTaskServer::registerHandler(uint32_t kind, Handler handler)
+{
+    if(isRunning_)return;
+    handlers_[kind] = std::move(handler);
+}
+
+bool ShmTaskServer::start()
+{
+    if(isRunning_)return true;
+    shm_unlink(name_.c_str()); // 删除上次残留的
+    int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0)
+    {
+        std::cerr << "shm_open " << name_ << " failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if(ftruncate(fd, sizeof(ShmSegment)) != 0)
+    {
+        std::cerr << "ftruncate " << name_ << " failed: " << strerror(errno) << std::endl;
+        close(fd);
+        shm_unlink(name_.c_str());
+        return false;
+    }
+    void* addr = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+    {
+        std::cerr << "mmap " << name_ << " failed: " << strerror(errno) << std::endl;
+        shm_unlink(name_.c_str());
+        return false;
+    }
+    seg_ = static_cast<ShmSegment*>(addr);
+    seg_->nextId.store(1);
+    seg_->submitQ.init();
+    seg_->completeQ.init();
+    seg_->magic.store(SHM_MAGIC, std::memory_order_release); // 最后写 客户端看到才算就绪
+    isRunning_ = true;
+    dispatcher_ = std::thread(&ShmTaskServer::dispatchLoop, this);
+    return true;
+}
+
+// 完成队列的信用：剩余空位减去已经取出还没写回结果的请求
+// 只在有信用时取请求 工作线程写结果时完成队列一定有位置 客户端不取结果也不会卡住线程池
+size_t ShmTaskServer::credits()
+{
+    uint64_t used = occupied(seg_->completeQ) + outstanding_.load();
+    return used >= SHM_RING_SIZE ? 0 : (size_t)(SHM_RING_SIZE - used);
+}
+
+// 从提交队列取请求 打包后交给线程池
+void ShmTaskServer::dispatchLoop()
+{
+    Message msg;
+    for(;;)
+    {
+        // 没有信用 等客户端取走结果
+        size_t limit = credits();
+        for(int spins = 0; limit == 0; spins++)
+        {
+            if(!isRunning_)
+                return;
+            backoff(spins);
+            limit = credits();
+        }
+        if(!popWait(seg_->submitQ, msg, -1, &isRunning_))
+            return;
+        std::vector<Message> batch;
+        batch.push_back(msg);
+        limit = std::min(limit, SHM_DISPATCH_BATCH);
+        while(batch.size() < limit && tryPop(seg_->submitQ, msg))
+            batch.push_back(msg);
+        outstanding_ += batch.size();
+        pending_++;
+        auto task = std::make_shared<ShmDispatchTask>(this, std::move(batch), pending_);
+        // 线程池不接收 就在分发线程上执行
+        if(!post_(task))
+            task->run();
+    }
+}
+
+void ShmTaskServer::process(uint32_t kind, uint64_t id, const char* data, size_t len)
+{
+    Message res;
+    res.id = id;
+    res.kind = kind;
+    res.len = 0;
+    auto it = handlers_.find(kind);
+    if(len > SHM_PAYLOAD_SIZE)
+    {
+        std::cerr << "shm task " << id << " bad length: " << len << std::endl;
+        res.status = SHM_STATUS_BAD_LENGTH;
+    }
+    else if(it == handlers_.end())
+    {
+        res.status = SHM_STATUS_NO_HANDLER;
+    }
+    else
+    {
+        std::string out;
+        res.status = it->second(data, len, out);
+        if(out.size() > SHM_PAYLOAD_SIZE)
+        {
+            std::cerr << "shm task " << id << " output too large: " << out.size() << std::endl;
+            out.resize(SHM_PAYLOAD_SIZE);
+        }
+        memcpy(res.data, out.data(), out.size());
+        res.len = (uint32_t)out.size();
+    }
+    // 有信用保证 运行中不会等待；停止后客户端不再取结果 放弃
+    push(seg_->completeQ, res, &isRunning_);
+    outstanding_--;
+}
+
+ShmTaskClient::ShmTaskClient()
+:seg_(nullptr)
+{
+
+}
+
+ShmTaskClient::~ShmTaskClient()
+{
+    if(seg_ != nullptr)
+        munmap(seg_, sizeof(ShmSegment));
+}
+
+bool ShmTaskClient::connect(const std::string& name)
+{
+    if(seg_ != nullptr)return true;
+    std::string path = shmName(name);
+    int fd = shm_open(path.c_str(), O_RDWR, 0600);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size != sizeof(ShmSegment))
+    {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+        return false;
+    ShmSegment* seg = static_cast<ShmSegment*>(addr);
+    if(seg->magic.load(std::memory_order_acquire) != SHM_MAGIC)
+    {
+        munmap(addr, sizeof(ShmSegment));
+        return false;
+    }
+    seg_ = seg;
+    return true;
+}
+
+uint64_t ShmTaskClient::submit(uint32_t kind, const void* data, size_t len)
+{
+    if(seg_ == nullptr || len > SHM_PAYLOAD_SIZE)
+        return 0;
+    Message msg;
+    msg.id = seg_->nextId.fetch_add(1);
+    msg.kind = kind;
+    msg.status = 0;
+    msg.len = (uint32_t)len;
+    memcpy(msg.data, data, len);
+    push(seg_->submitQ, msg, nullptr);
+    return msg.id;
+}
+
+bool ShmTaskClient::wait(ShmCompletion& completion, int timeoutMs)
+{
+    if(seg_ == nullptr)
+        return false;
+    Message msg;
+    if(!popWait(seg_->completeQ, msg, timeoutMs, nullptr))
+        return false;
+    completion.id = msg.id;
+    if(msg.len > SHM_PAYLOAD_SIZE)
+    {
+        completion.status = SHM_STATUS_BAD_LENGTH;
+        completion.data.clear();
+        return true;
+    }
+    completion.status = msg.status;
+    completion.data.assign(msg.data, msg.len);
+    return true;
+}
+#endif
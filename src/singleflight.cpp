@@ -0,0 +1,182 @@
+#include "singleflight.h"
+
+// 调用方 Result 绑定的任务 不进队列 拿到返回值时直接 exec 写进 Result
+class FlightWaiter : public Task
+{
+public:
+    void deliver(Any value)
+    {
+        value_ = std::move(value);
+        exec();
+    }
+    Any run()
+    {
+        return std::move(value_);
+    }
+private:
+    Any value_;
+};
+
+// 真正进队列的任务 执行用户任务后把返回值分给所有等待者
+class FlightTask : public Task
+{
+public:
+    FlightTask(SingleFlight& flight, const std::string& key, std::shared_ptr<Task> task)
+    :flight_(flight),key_(key),task_(std::move(task)){}
+    Any run()
+    {
+        flight_.complete(key_, task_->run());
+        return Any();
+    }
+    size_t footprint() const { return sizeof(FlightTask) + task_->footprint(); }
+private:
+    SingleFlight& flight_;
+    std::string key_;
+    std::shared_ptr<Task> task_;
+};
+
+// 提交放在析构里：submit 的返回值（Result）构造完、绑定到 waiter 之后才提交
+// 否则任务可能在 Result 绑定之前就执行完 返回值丢失
+class SingleFlight::PostGuard
+{
+public:
+    PostGuard(SingleFlight& flight, const std::string& key, std::shared_ptr<Task> task)
+    :flight_(flight),key_(key),task_(std::move(task)){}
+    ~PostGuard()
+    {
+        if(!flight_.post_(task_))
+            flight_.fail(key_);
+    }
+private:
+    SingleFlight& flight_;
+    const std::string& key_;
+    std::shared_ptr<Task> task_;
+};
+
+SingleFlight::SingleFlight(TaskPoster post)
+:post_(std::move(post))
+{
+
+}
+
+Result SingleFlight::submit(const std::string& key, std::shared_ptr<Task> task)
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    // 1.缓存命中 直接返回有值的Result
+    auto cit = cache_.find(key);
+    if(cit != cache_.end())
+    {
+        if(Clock::now() < cit->second.expire)
+        {
+            stats_.hits++;
+            lru_.splice(lru_.begin(), lru_, cit->second.lru);
+            return Result(Result::ReadyTag(), cit->second.value.clone());
+        }
+        lru_.erase(cit->second.lru);
+        cache_.erase(cit);
+        stats_.expired++;
+    }
+    auto waiter = std::make_shared<FlightWaiter>();
+    // 2.同 key 正在执行 排队等同一个返回值
+    // 持有锁构造 Result 执行完成（complete）一定在 Result 绑定之后
+    auto it = inflight_.find(key);
+    if(it != inflight_.end())
+    {
+        stats_.coalesced++;
+        it->second.waiters.push_back(waiter);
+        return Result(waiter);
+    }
+    // 3.第一个提交 真正执行
+    inflight_[key].waiters.push_back(waiter);
+    stats_.executed++;
+    lock.unlock();
+    PostGuard guard(*this, key, std::make_shared<FlightTask>(*this, key, std::move(task)));
+    return Result(waiter);
+}
+
+void SingleFlight::complete(const std::string& key, Any value)
+{
+    Waiters waiters;
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        bool stale = false;
+        auto it = inflight_.find(key);
+        if(it != inflight_.end())
+        {
+            waiters.swap(it->second.waiters);
+            stale = it->second.stale;
+            inflight_.erase(it);
+        }
+        if(capacity_ > 0 && !stale)
+        {
+            auto cit = cache_.find(key);
+            if(cit != cache_.end())
+                lru_.erase(cit->second.lru);
+            lru_.push_front(key);
+            cache_[key] = CacheEntry{value.clone(), Clock::now() + ttl_, lru_.begin()};
+            evict();
+        }
+    }
+    // 最后一个直接拿走原值 少拷贝一次
+    for(size_t i = 0; i < waiters.size(); i++)
+        waiters[i]->deliver(i + 1 == waiters.size() ? std::move(value) : value.clone());
+}
+
+void SingleFlight::fail(const std::string& key)
+{
+    Waiters waiters;
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        auto it = inflight_.find(key);
+        if(it != inflight_.end())
+        {
+            waiters.swap(it->second.waiters);
+            inflight_.erase(it);
+        }
+        stats_.rejected++;
+    }
+    for(auto& waiter : waiters)
+        waiter->reject();
+}
+
+void SingleFlight::setCache(size_t capacity, std::chrono::milliseconds ttl)
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    capacity_ = capacity;
+    ttl_ = ttl;
+    evict();
+}
+
+void SingleFlight::forget(const std::string& key)
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    // 正在执行的结果可能基于旧数据 执行完不写入缓存
+    auto it = inflight_.find(key);
+    if(it != inflight_.end())
+        it->second.stale = true;
+    auto cit = cache_.find(key);
+    if(cit == cache_.end())
+        return;
+    lru_.erase(cit->second.lru);
+    cache_.erase(cit);
+}
+
+SingleFlightStats SingleFlight::stats()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    SingleFlightStats stats = stats_;
+    stats.inflight = inflight_.size();
+    stats.cached = cache_.size();
+    return stats;
+}
+
+// 超出容量 淘汰最久没用的 持有 mtx_
+void SingleFlight::evict()
+{
+    while(cache_.size() > capacity_)
+    {
+        cache_.erase(lru_.back());
+        lru_.pop_back();
+        stats_.evicted++;
+    }
+}
@@ -1,256 +1,111 @@
 #include "threadpool.h"
+#include<algorithm>
 #include<functional>
 #include<iostream>
 #include<chrono>
-const int TASK_MAX = INT32_MAX;
-const int THREAD_MAX = 10;
-const int THREAD_MAX_IDLE_TIME = 10; //60s空闲 回收线程
-//构造函数
-ThreadPool::ThreadPool()
-:_initThreadSize(4)
-,_taskSize(0)
-,idleThreadSize_(0)
-,_maxTaskSize(TASK_MAX)
-,_maxThreadSize(THREAD_MAX)
-,_nowMode(PoolMode::MODE_FIXED)
-,isPoolRunning_(false)
-,curThreadSize_(0)
-{
-    
-}
-// 析构函数
-ThreadPool::~ThreadPool() 
-{
-    isPoolRunning_ = false;
-    // 等待线程池中的线程 全部返回才析构
-    std::unique_lock<std::mutex>lock(_taskQueMtx);
-    // 先抢锁 在notify
-    _notEmpty.notify_all();
-    _exitCond.wait(lock,[&]() -> bool {
-        return _threads.size() == 0;
-    });
-}
-bool ThreadPool::checkPoolRunning() const
-{ 
-    return isPoolRunning_; 
-}
-// 设置线程池工作模式
-void ThreadPool::setMode(PoolMode mode) {
-    if(checkPoolRunning())return;
-    _nowMode = mode;
-}
-void ThreadPool::start(int initThreadSize) 
-{
-    isPoolRunning_ = true;
-    _initThreadSize = initThreadSize;
-    curThreadSize_ = initThreadSize;
-    // 创建线程对象
-    for(size_t i=0;i<_initThreadSize;i++)
-    {
-        // 绑定器 决定线程执行的函数
-        auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc,this,std::placeholders::_1));
-        int tid = ptr->getID();
-        _threads.emplace(tid,std::move(ptr));
-        //_threads.emplace_back(std::move(ptr));
-        //_threads.emplace_back(new Thread(std::bind(&ThreadPool::threadFunc,this)));
-    }
+#include<climits>
+#include<cstring>
+#ifndef _WIN32
+#include<pthread.h>
+#endif
 
-    // 启动线程 std::vector<Thread*> _threads
-    for(size_t i=0;i<_initThreadSize;i++)
-    {
-        // 线程执行 需要task 函数
-        _threads[i]->start();
-        idleThreadSize_++; // 空闲数量
-    } 
-}
-// 设置任务队列上限
-void ThreadPool::setTaskQueMaxSize(int threshhold) 
+Thread::Thread(ThreadFunc func, const ThreadAttr& attr) 
+:func_(func)
+,attr_(attr)
+,threadId_(generate_id++)
 {
-    if(checkPoolRunning())return;
-    _maxTaskSize = threshhold;
+
 }
-// 设置线程数量上限
-void ThreadPool::setThreadMaxSize(int threshhold)
+
+Thread::~Thread() 
 {
-    if(checkPoolRunning())return;
-    if(PoolMode::MODE_CACHED == _nowMode)
-    {
-        _maxThreadSize = threshhold;
-    }
+
 }
-Result ThreadPool::submit(std::shared_ptr<Task> sp) {
-    // 上锁 
-    std::unique_lock<std::mutex>lock(_taskQueMtx);
-    // 用户提交任务 阻塞超过一秒 判断提交失败
-    // 等待任务 线程通信 cv 
-    if( !_notFull.wait_for(lock,std::chrono::seconds(1),[&]()->bool {
-        return _taskQueue.size() < (size_t)_maxTaskSize;
-    }))
-    {
-        // 超时 出错
-        std::cerr << "Task Submit TimeOut 1s , TaskQue is Full" << std::endl;
-        return Result(sp,false);
-    }
-    // while(_taskQueue.size() == (size_t)_maxTaskSize)
-    // {
-    //     //没空位
-    //     if(std::cv_status::no_timeout == _notFull.wait_for(lock,std::chrono::seconds(1))) // 让出锁 进入等待状态
-    //     {
-    //         // 超时 出错
-    //         std::cerr << "Task Submit TimeOut 1s , TaskQue is Full" << std::endl;
-    //         return;
-    //     }
-    // }
-    // _notFull.wait(lock,[&]()->bool {
-    //     return _taskQueue.size() < _maxTaskSize;
-    // });
 
-    // 有空位 提交任务
-    _taskQueue.emplace(sp);
-    _taskSize++;
+std::atomic_int Thread::generate_id(0);
 
-    // notEmpty 通知 可以分配工作线程
-    _notEmpty.notify_all();
+#ifndef _WIN32
+namespace
+{
+// pthread 入口参数 由新线程负责释放
+struct ThreadStart
+{
+    Thread::ThreadFunc func;
+    int threadId;
+    std::string name;
+};
 
-    // cached 模式下，根据任务数量和空闲线程数量，判断是否要 新增线程
-    // 适合 小而快的任务
-    // 线程太多对性能有影响
-    //cached模式 + 当前线程数量小于线程数量上限 + 当前任务数量大于空闲线程数量
-    if(PoolMode::MODE_CACHED == _nowMode 
-        && curThreadSize_ < _maxThreadSize 
-        && _taskSize > idleThreadSize_)
-    {
-        //创建新线程
-        auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc,this,std::placeholders::_1));
-        int tid = ptr->getID();
-        _threads.emplace(tid,std::move(ptr));
-        _threads[tid]->start(); // 启动线程
-        curThreadSize_++;
-        idleThreadSize_++;
-        std::cout<<"Create New Thread:"<<std::endl;
-    }
-    return Result(sp);
-}
-// 线程执行任务函数 线程从任务队列消费任务
-// 线程池里有任务，必须等到任务完成，才能析构
-void ThreadPool::threadFunc(int threadID) 
+void* threadEntry(void* arg)
 {
-    auto lastTime = std::chrono::high_resolution_clock().now();
-    // 循环接受任务
-    for(;;)
+    std::unique_ptr<ThreadStart> start(static_cast<ThreadStart*>(arg));
+    if(!start->name.empty())
     {
-        std::shared_ptr<Task>task;
-        {
-            // 1.获取锁
-            std::unique_lock<std::mutex>lock(_taskQueMtx);
-            
-            std::cout<<"tid:"<<std::this_thread::get_id()<<" Try Get Task"<<std::endl;
-
-            // TODO: cached模式下 空闲线程 超60s 无任务，销毁
-            // 区分超时返回 and 有任务待执行返回
-            while (_taskQueue.size() == 0)
-            {
-                // 没任务 当前如果线程池已经关闭，则回收线程
-                if(isPoolRunning_ == false)
-                {
-                    //回收线程
-                    _threads.erase(threadID);
-                    _exitCond.notify_all();
-                    std::cout<<"ThreadID:"<<std::this_thread::get_id()<<" exit!"<<std::endl;
-                    return;
-                }
-                // cached 模式 如果空闲时间达到THREAD_MAX_IDLE_TIME 回收线程
-                if(PoolMode::MODE_CACHED == _nowMode)
-                {
-                    // 条件变量超时返回 没抢到任务
-                    if(std::cv_status::timeout ==
-                        _notEmpty.wait_for(lock,std::chrono::seconds(1)))
-                    {
-                        auto nowTime = std::chrono::high_resolution_clock().now();
-                        auto dur = std::chrono::duration_cast<std::chrono::seconds>(nowTime-lastTime);
-                        if(curThreadSize_>_initThreadSize && dur.count() >= THREAD_MAX_IDLE_TIME)
-                        {
-                            // 回收当前线程
-                            // 线程vector 删除对象；线程相关变量修改
-                            _threads.erase(threadID);
-                            _exitCond.notify_all();
-                            curThreadSize_--;
-                            idleThreadSize_--;
-                            std::cout<<"ThreadID:"<<std::this_thread::get_id()<<" exit!"<<std::endl;
-                            return; // 结束线程
-                        }
-                    }
-                }
-                else // fixed 模式 一直wait
-                {
-                    //_notEmpty.wait(lock,[&]()->bool {return _taskQueue.size() > 0;});
-                    _notEmpty.wait(lock);
-                }
-                // 如果此时_notEmpty被唤醒，检查是不是Pool要被析构了
-                // if(isPoolRunning_ == false)
-                // {
-                //     // 回收线程
-                //     _threads.erase(threadID);
-                //     _exitCond.notify_all();
-                //     std::cout<<"ThreadID:"<<std::this_thread::get_id()<<" exit!"<<std::endl;
-                //     return;
-                // }
-            }
-            // 如果此时_notEmpty被唤醒，检查是不是Pool要被析构了
-            // 2.等待 notEmpty 信号
-            // while(_taskQueue.size() == 0)
-            // {
-            //     _notEmpty.wait(lock);
-            // }
-            
-            std::cout<<"tid:"<<std::this_thread::get_id()<<" Success Get Task"<<std::endl;
-            idleThreadSize_--; // 线程取任务 不空闲
-            // 3.任务队列获取任务
-            task = _taskQueue.front();
-            _taskQueue.pop();
-            _taskSize--;
-            
-            // 可以继续执行任务
-            if(_taskQueue.size() > 0)
-                _notEmpty.notify_all();
-
-            // 可以继续提交任务
-            _notFull.notify_all();
-            // 4.当前线程执行任务 释放锁
-        }
-        if(task!=nullptr)
-        {
-            task->exec();
-            // 执行完任务 通知
-            std::cout<<"Task Finished"<<std::endl;
-        }
-        idleThreadSize_++; // 任务完成 空闲
-        // 更新使用时间
-        lastTime = std::chrono::high_resolution_clock().now();
+#if defined(__linux__)
+        pthread_setname_np(pthread_self(), start->name.c_str());
+#elif defined(__APPLE__)
+        pthread_setname_np(start->name.c_str());
+#endif
     }
+    start->func(start->threadId);
+    return nullptr;
 }
-
-Thread::Thread(ThreadFunc func) 
-:func_(func)
-,threadId_(generate_id++)
-{
-
-}
-
-Thread::~Thread() 
-{
-
 }
+#endif
 
-int Thread::generate_id = 0;
 // 启动线程
 void Thread::start() 
 {
+#ifndef _WIN32
+    // 用 pthread 属性设置栈大小 / 保护页 / 线程名
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED); //设置分离线程
+    if(attr_.stackSize > 0)
+        pthread_attr_setstacksize(&attr, std::max<size_t>(attr_.stackSize, PTHREAD_STACK_MIN));
+    if(attr_.guardSize > 0)
+        pthread_attr_setguardsize(&attr, attr_.guardSize);
+    ThreadStart* start = new ThreadStart{func_, threadId_, std::string()};
+    if(!attr_.name.empty())
+    {
+        // Linux 线程名最多15个字符 截断基础名 保证id完整
+        std::string suffix = "-" + std::to_string(threadId_);
+        start->name = attr_.name.substr(0, suffix.size() < 15 ? 15 - suffix.size() : 0) + suffix;
+    }
+    pthread_t tid;
+    int err = pthread_create(&tid, &attr, threadEntry, start);
+    pthread_attr_destroy(&attr);
+    if(err == 0)
+        return;
+    delete start;
+    std::cerr << "pthread_create failed: " << strerror(err) << ", use default attributes" << std::endl;
+#endif
     // 需要执行函数
     std::thread t(this->func_,threadId_);
     t.detach(); //设置分离线程 
 }
 
+size_t Thread::reservedStackSize(const ThreadAttr& attr)
+{
+#ifndef _WIN32
+    if(attr.stackSize > 0 && attr.guardSize > 0)
+        return std::max<size_t>(attr.stackSize, PTHREAD_STACK_MIN) + attr.guardSize;
+    // 没有设置的部分取 pthread 默认值
+    pthread_attr_t def;
+    pthread_attr_init(&def);
+    size_t stack = 0, guard = 0;
+    pthread_attr_getstacksize(&def, &stack);
+    pthread_attr_getguardsize(&def, &guard);
+    pthread_attr_destroy(&def);
+    if(attr.stackSize > 0)
+        stack = std::max<size_t>(attr.stackSize, PTHREAD_STACK_MIN);
+    if(attr.guardSize > 0)
+        guard = attr.guardSize;
+    return stack + guard;
+#else
+    return attr.stackSize > 0 ? attr.stackSize : 1024 * 1024; // Windows 默认1MB
+#endif
+}
+
 int Thread::getID() const
 {
     return threadId_;
@@ -272,20 +127,57 @@ void Result::setVal(Any any) // task调用
     sem_.post(); //任务返回值获取了，生成一个资源，让用户get不阻塞
 }
 
+void Result::setInvalid()
+{
+    isValid_ = false;
+    sem_.post(); // 已经阻塞在 get 上的调用方拿到空值
+}
+
 //封装运行
 void Task::exec()
 {
+    Any any = run(); //多态调用
+    // Result 可能已经被丢弃 加锁后再判断
+    std::lock_guard<std::mutex>lock(rsMtx_);
     if(rs_ != nullptr)
-        rs_->setVal(run()); //多态调用
+        rs_->setVal(std::move(any));
+}
+
+void Task::reject()
+{
+    std::lock_guard<std::mutex>lock(rsMtx_);
+    if(rs_ != nullptr)
+        rs_->setInvalid();
 }
 
 void Task::setResult(Result* rs)
 {
+    std::lock_guard<std::mutex>lock(rsMtx_);
     rs_ = rs;
 }
-Result::Result(std::shared_ptr<Task> task, bool isValid)
+Result::Result(std::shared_ptr<Task> task, bool isValid, std::shared_ptr<std::atomic_int> liveCounter)
 	: isValid_(isValid)
 	, task_(task)
+	, liveCounter_(std::move(liveCounter))
 {
 	task_->setResult(this);
-}
\ No newline at end of file
+    liveCount_++;
+    if(liveCounter_ != nullptr)
+        (*liveCounter_)++;
+}
+Result::Result(ReadyTag, Any value)
+	: isValid_(true)
+{
+    data_ = std::move(value);
+    sem_.post();
+    liveCount_++;
+}
+Result::~Result()
+{
+    if(task_ != nullptr)
+        task_->setResult(nullptr);
+    liveCount_--;
+    if(liveCounter_ != nullptr)
+        (*liveCounter_)--;
+}
+std::atomic_int Result::liveCount_(0);
\ No newline at end of file
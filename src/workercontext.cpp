@@ -0,0 +1,83 @@
+#include "workercontext.h"
+#include "fiber.h"
+#include<algorithm>
+#include<cstdint>
+
+Arena::Arena(size_t blockSize)
+:blockSize_(blockSize)
+,cur_(0)
+,offset_(0)
+,used_(0)
+{
+
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+    if(size == 0)
+        size = 1;
+    for(;;)
+    {
+        if(cur_ < blocks_.size())
+        {
+            Block& block = blocks_[cur_];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+            size_t start = ((base + offset_ + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if(start + size <= block.size)
+            {
+                used_ += start + size - offset_;
+                offset_ = start + size;
+                return block.data.get() + start;
+            }
+            // 当前块放不下 换下一块（reset 后留下的块也会按顺序复用）
+            if(cur_ + 1 < blocks_.size())
+            {
+                cur_++;
+                offset_ = 0;
+                continue;
+            }
+        }
+        // 没有可用的块 新分配一块 大对象单独一块
+        size_t bytes = std::max(blockSize_, size + align);
+        blocks_.push_back(Block{std::unique_ptr<char[]>(new char[bytes]), bytes});
+        cur_ = blocks_.size() - 1;
+        offset_ = 0;
+    }
+}
+
+void Arena::reset()
+{
+    cur_ = 0;
+    offset_ = 0;
+    used_ = 0;
+}
+
+size_t Arena::capacity() const
+{
+    size_t bytes = 0;
+    for(auto& block : blocks_)
+        bytes += block.size;
+    return bytes;
+}
+
+std::atomic<size_t> WorkerContext::nextSlot_(0);
+thread_local WorkerContext* WorkerContext::current_ = nullptr;
+
+WorkerContext::WorkerContext(int threadId, int workerIndex)
+:threadId_(threadId)
+,workerIndex_(workerIndex)
+{
+    current_ = this;
+}
+
+WorkerContext::~WorkerContext()
+{
+    current_ = nullptr;
+}
+
+Arena& WorkerContext::arena()
+{
+    // fiber 挂起后可能在别的线程继续 不能用工作线程的分配器
+    Arena* fiberArena = Fiber::currentArena();
+    return fiberArena != nullptr ? *fiberArena : arena_;
+}